@@ -0,0 +1,45 @@
+/* Copyright (c) 2020 - 2021 Marcelo Zimbres Silva (mzimbres at gmail dot com)
+ *
+ * This file is part of tsvtree.
+ *
+ * tsvtree is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tsvtree is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tsvtree.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "arena.hpp"
+
+namespace tsvtree
+{
+
+void* arena::allocate_slow(std::size_t n, std::size_t align)
+{
+   constexpr std::size_t max_block_size = 64 << 20;
+
+   // Requests that are large compared to the block size get a block
+   // of their own so that the current block is not wasted.
+   auto const size = n + align;
+   if (size > next_block_size_ / 4) {
+      blocks_.emplace_back(new char[size]);
+      auto const p = reinterpret_cast<std::uintptr_t>(blocks_.back().get());
+      return blocks_.back().get() + (align - p % align) % align;
+   }
+
+   blocks_.emplace_back(new char[next_block_size_]);
+   cur_ = blocks_.back().get();
+   left_ = next_block_size_;
+   next_block_size_ = std::min(2 * next_block_size_, max_block_size);
+
+   return allocate(n, align);
+}
+
+} // tsvtree
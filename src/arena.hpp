@@ -0,0 +1,111 @@
+/* Copyright (c) 2020 - 2021 Marcelo Zimbres Silva (mzimbres at gmail dot com)
+ *
+ * This file is part of tsvtree.
+ *
+ * tsvtree is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tsvtree is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tsvtree.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <new>
+#include <memory>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <string_view>
+#include <type_traits>
+
+#include "utils.hpp"
+
+namespace tsvtree
+{
+
+// Monotonic allocator. Memory is bump-allocated from large blocks
+// that are released all at once when the arena is destroyed. Only
+// trivially destructible objects can be created in it since no
+// destructors are ever called.
+class arena {
+private:
+   std::vector<std::unique_ptr<char[]>> blocks_;
+   char* cur_ = nullptr;
+   std::size_t left_ = 0;
+   std::size_t next_block_size_;
+
+   void* allocate_slow(std::size_t n, std::size_t align);
+
+public:
+   arena(arena const&) = delete;
+   arena& operator=(arena const&) = delete;
+   arena(arena&&) = delete;
+   arena& operator=(arena&&) = delete;
+   explicit arena(std::size_t block_size = 1 << 16)
+   : next_block_size_ {block_size}
+   { }
+
+   void* allocate(std::size_t n, std::size_t align)
+   {
+      auto const p = reinterpret_cast<std::uintptr_t>(cur_);
+      auto const pad = (align - p % align) % align;
+      if (pad + n > left_)
+         return allocate_slow(n, align);
+
+      auto* ret = cur_ + pad;
+      cur_ += pad + n;
+      left_ -= pad + n;
+      return ret;
+   }
+
+   template <class T, class... Args>
+   T* make(Args&&... args)
+   {
+      static_assert(std::is_trivially_destructible<T>::value);
+      auto* p = allocate(sizeof (T), alignof (T));
+      return new (p) T {std::forward<Args>(args)...};
+   }
+
+   template <class T>
+   array_view<T> make_array(int n)
+   {
+      static_assert(std::is_trivially_destructible<T>::value);
+      if (n == 0)
+         return {};
+
+      auto* p = static_cast<T*>(allocate(n * sizeof (T), alignof (T)));
+      std::uninitialized_value_construct_n(p, n);
+      return {p, n};
+   }
+
+   template <class C>
+   auto copy(C const& c)
+   {
+      using value_type = typename C::value_type;
+      auto ret = make_array<value_type>(tsvtree::ssize(c));
+      std::copy(std::cbegin(c), std::cend(c), std::begin(ret));
+      return ret;
+   }
+
+   std::string_view copy(std::string_view s)
+   {
+      if (std::empty(s))
+         return {};
+
+      auto* p = static_cast<char*>(allocate(std::size(s), 1));
+      std::memcpy(p, s.data(), std::size(s));
+      return {p, std::size(s)};
+   }
+};
+
+} // tsvtree
@@ -0,0 +1,31 @@
+#!/bin/bash
+
+# Runs tsvbench on datasets generated by tsvsim with fixed seeds, see
+# make bench. Must be called from the build directory, the arguments
+# are passed to tsvbench e.g. --json or --threads 4.
+
+set -e
+
+dir=`mktemp -d`
+trap "rm -rf $dir" EXIT
+
+# The name of each dataset followed by the arguments of tsvsim. With
+# positional arguments (lines, depth, word length and seed) the
+# fan-out of each level grows with the word length.
+datasets="
+small  100000 8 2 1
+wide   200000 4 4 2
+deep   20000 60 1 3
+large  1000000 8 3 4
+skewed --rows 1000000 --depth 7 --min-depth 3 --fanout 20,200,50 --zipf 1.1 --name-length 12 --seed 5
+"
+
+files=
+while read name args
+do
+   [[ -z $name ]] && continue
+   ./tsvsim $args > $dir/$name.tsv
+   files="$files $dir/$name.tsv"
+done <<< "$datasets"
+
+./tsvbench "$@" $files
@@ -4,11 +4,17 @@ tsv_orig=`./tsvsim 10000 40 1 1`
 tsv_ref=`echo $tsv_orig | ./tsvtree -o comp | ./tsvtree --tree -o tsv`
 tsv_from_tree=`echo $tsv_ref | ./tsvtree --indent-with-tab -o tree | ./tsvtree --tree -o tsv`
 tsv_from_comp=`echo $tsv_ref | ./tsvtree -o comp | ./tsvtree --tree -o tsv`
+tsv_from_bin=`echo $tsv_ref | ./tsvtree -o bin | ./tsvtree -o tsv`
+tsv_from_comp_bin=`echo $tsv_ref | ./tsvtree -o comp-bin | ./tsvtree -o tsv`
+tsv_from_comp_bin_checksums=`echo $tsv_ref | ./tsvtree -o comp-bin --checksums | ./tsvtree -o tsv`
 
 #echo $tsv_orig
 #echo $tsv_ref
 #echo $tsv_from_tree
 #echo $tsv_from_comp
+#echo $tsv_from_bin
+#echo $tsv_from_comp_bin
+#echo $tsv_from_comp_bin_checksums
 
 if [[ $tsv_ref != $tsv_from_tree ]]
 then
@@ -22,4 +28,50 @@ then
    exit 1
 fi
 
+if [[ $tsv_ref != $tsv_from_bin ]]
+then
+   echo "Fail"
+   exit 1
+fi
+
+if [[ $tsv_ref != $tsv_from_comp_bin ]]
+then
+   echo "Fail"
+   exit 1
+fi
+
+if [[ $tsv_ref != $tsv_from_comp_bin_checksums ]]
+then
+   echo "Fail"
+   exit 1
+fi
+
+tmp=`mktemp -d`
+trap 'rm -rf $tmp' EXIT
+
+printf 'a\tb\n' > $tmp/one.tsv
+printf 'b\tq\na\tz\n' > $tmp/unsorted.tsv
+unsorted_err=`./tsvtree --sorted $tmp/one.tsv $tmp/unsorted.tsv 2>&1 >/dev/null`
+
+if [[ $? != 1 || $unsorted_err != "Input is not sorted"* ]]
+then
+   echo "Fail"
+   exit 1
+fi
+
+# Thousands of runs, which are premerged before the final merge.
+./tsvsim 2000 40 1 1 > $tmp/sim.tsv
+
+for flags in "" "-p" "-o comp"
+do
+   in_memory=`./tsvtree $flags --file $tmp/sim.tsv`
+   external=`./tsvtree $flags --memory-limit 1K --file $tmp/sim.tsv`
+
+   if [[ $in_memory != $external ]]
+   then
+      echo "Fail"
+      exit 1
+   fi
+done
+
 echo "OK"
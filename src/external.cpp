@@ -0,0 +1,786 @@
+/* Copyright (c) 2020 - 2021 Marcelo Zimbres Silva (mzimbres at gmail dot com)
+ *
+ * This file is part of tsvtree.
+ *
+ * tsvtree is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tsvtree is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tsvtree.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "external.hpp"
+
+#include <deque>
+#include <queue>
+#include <mutex>
+#include <thread>
+#include <memory>
+#include <vector>
+#include <exception>
+#include <condition_variable>
+#include <csignal>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+
+#include "input.hpp"
+#include "output.hpp"
+#include "stats.hpp"
+#include "utils.hpp"
+
+namespace tsvtree
+{
+
+// A directory for the runs that is removed together with its files.
+class temp_dir;
+
+// The directories that exist, removed when the process is interrupted.
+std::mutex temp_dirs_mutex;
+std::vector<temp_dir*> temp_dirs;
+
+class temp_dir {
+private:
+   std::string path_;
+   std::vector<std::string> files_;
+
+public:
+   temp_dir(temp_dir const&) = delete;
+   temp_dir& operator=(temp_dir const&) = delete;
+
+   temp_dir()
+   {
+      auto const* tmp = std::getenv("TMPDIR");
+      path_ = std::string {tmp && *tmp ? tmp : "/tmp"} + "/tsvtree.XXXXXX";
+      if (!::mkdtemp(path_.data()))
+         throw std::runtime_error("Unable to create a temporary directory: " + std::string {std::strerror(errno)});
+
+      std::lock_guard<std::mutex> lock {temp_dirs_mutex};
+      temp_dirs.push_back(this);
+   }
+
+   ~temp_dir()
+   {
+      std::lock_guard<std::mutex> lock {temp_dirs_mutex};
+      temp_dirs.erase(std::find(std::begin(temp_dirs), std::end(temp_dirs), this));
+      remove_all();
+   }
+
+   // Removes the files and the directory, with temp_dirs_mutex locked.
+   void remove_all()
+   {
+      for (auto const& f : files_)
+         ::unlink(f.c_str());
+
+      ::rmdir(path_.c_str());
+   }
+
+   // Removes a file early, the destructor ignores it then.
+   void remove(std::string const& path) { ::unlink(path.c_str()); }
+
+   // Creates a file in the directory and returns its descriptor.
+   int create(std::string const& name, std::string& path)
+   {
+      path = path_ + "/" + name;
+      std::lock_guard<std::mutex> lock {temp_dirs_mutex};
+      auto const fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+      if (fd == -1)
+         throw std::runtime_error("Unable to create " + path + ": " + std::strerror(errno));
+
+      files_.push_back(path);
+      return fd;
+   }
+};
+
+// Removes the temporary directories on SIGINT and SIGTERM. The signals
+// are blocked and waited for in a thread of their own, where the
+// directories can be removed safely, and then raised again to end the
+// process as they would have. Called before any other thread is
+// started, since threads inherit the blocked signals.
+void remove_temp_dirs_on_signal()
+{
+   static std::once_flag once;
+   std::call_once(once, [] {
+      sigset_t set;
+      ::sigemptyset(&set);
+      ::sigaddset(&set, SIGINT);
+      ::sigaddset(&set, SIGTERM);
+      ::pthread_sigmask(SIG_BLOCK, &set, nullptr);
+
+      std::thread {[set] {
+         auto sig = 0;
+         if (::sigwait(&set, &sig) != 0)
+            return;
+
+         // The lock is kept so that no file is created until the end.
+         temp_dirs_mutex.lock();
+         for (auto* d : temp_dirs)
+            d->remove_all();
+
+         std::signal(sig, SIG_DFL);
+         ::pthread_sigmask(SIG_UNBLOCK, &set, nullptr);
+         std::raise(sig);
+      }}.detach();
+   });
+}
+
+// Closes the descriptor of a temporary file.
+struct fd_guard {
+   int fd;
+
+   fd_guard(fd_guard const&) = delete;
+   fd_guard& operator=(fd_guard const&) = delete;
+   explicit fd_guard(int fd_) : fd {fd_} { }
+   ~fd_guard() { ::close(fd); }
+};
+
+// A sorted file, either a chunk of the input written to the temporary
+// directory or a sorted input file. The first and last values of the
+// first field decide whether a root node has to be added.
+struct run {
+   std::string path;
+   std::string first;
+   std::string last;
+   bool temporary = true;
+};
+
+// Approximate memory used by a chunk, its rows and the arrays used to
+// sort them.
+std::size_t chunk_memory(std::size_t bytes, std::size_t fields, std::size_t rows) noexcept
+{
+   return bytes + fields * sizeof(std::string_view) + rows * 4 * sizeof(tsv_row);
+}
+
+run
+write_run(std::string_view chunk,
+          tsv_cfg const& op,
+          temp_dir& dir,
+          int n)
+{
+   auto table = parse_tsv(chunk, op.in_field_sep, op.threads);
+   sort_rows(table.rows, op.threads);
+
+   run ret;
+   fd_guard fd {dir.create("run" + std::to_string(n), ret.path)};
+   fd_sink os {fd.fd};
+   for (auto const& row : table.rows) {
+      os << row[0];
+      for (auto i = 1; i < row.n; ++i)
+         os << op.in_field_sep << row[i];
+      os << '\n';
+   }
+
+   os.flush();
+   if (!std::empty(table.rows)) {
+      ret.first = table.rows.front()[0];
+      ret.last = table.rows.back()[0];
+   }
+
+   return ret;
+}
+
+class read_ahead_pool;
+
+// The rows of a sorted file, read in batches that are tokenized at
+// once. With a read_ahead_pool, its threads read and tokenize the next
+// batches while the current one is used, so that the inputs of a merge
+// are processed in parallel.
+class run_cursor {
+private:
+   friend class read_ahead_pool;
+
+   struct batch {
+      std::string data;
+      tsv_table table;
+   };
+
+   static constexpr std::size_t batch_size = 1 << 18;
+   static constexpr std::size_t queue_size = 2;
+
+   line_reader reader_;
+   char sep_;
+   std::unique_ptr<batch> current_;
+   int row_ = 0;
+
+   // Guarded by the mutex of the pool, if any.
+   read_ahead_pool* pool_;
+   std::deque<std::unique_ptr<batch>> queue_;
+   bool reading_ = false;
+   bool done_ = false;
+   std::exception_ptr error_;
+
+   std::unique_ptr<batch> read_batch()
+   {
+      auto ret = std::make_unique<batch>();
+      std::string_view line;
+      while (std::size(ret->data) < batch_size && reader_.next(line, '\n')) {
+         ret->data += line;
+         ret->data += '\n';
+      }
+
+      if (std::empty(ret->data))
+         return nullptr;
+
+      // The fields refer to the data, which does not move with the
+      // batch.
+      ret->table = parse_tsv(ret->data, sep_);
+      return ret;
+   }
+
+   std::unique_ptr<batch> pop();
+
+public:
+   run_cursor(run_cursor const&) = delete;
+   run_cursor& operator=(run_cursor const&) = delete;
+
+   run_cursor(std::string const& path, char sep, read_ahead_pool* pool)
+   : reader_ {path}
+   , sep_ {sep}
+   , pool_ {pool}
+   { }
+
+   // Moves to the next batch with rows, empty lines have none. Called
+   // once before the first row.
+   void load()
+   {
+      do {
+         current_ = pop();
+         row_ = 0;
+      } while (current_ && std::empty(current_->table.rows));
+   }
+
+   auto done() const noexcept { return !current_; }
+
+   array_view<std::string_view const> row() const noexcept
+   {
+      auto const& r = current_->table.rows[row_];
+      return {r.fields, r.n};
+   }
+
+   void next()
+   {
+      if (++row_ == tsvtree::ssize(current_->table.rows))
+         load();
+   }
+};
+
+// Threads that read ahead the batches of the cursors of a merge, as
+// many as allowed by --threads however many runs are merged. Each one
+// reads the next batch of the cursor with the fewest queued batches
+// that is not being read already. Must be destroyed before the
+// cursors.
+class read_ahead_pool {
+private:
+   std::mutex mutex_;
+   std::condition_variable cv_;
+   std::vector<run_cursor*> cursors_;
+   bool stop_ = false;
+   std::vector<std::thread> threads_;
+
+   run_cursor* next_cursor()
+   {
+      run_cursor* ret = nullptr;
+      for (auto* c : cursors_) {
+         if (c->reading_ || c->done_ || std::size(c->queue_) >= run_cursor::queue_size)
+            continue;
+
+         if (!ret || std::size(c->queue_) < std::size(ret->queue_))
+            ret = c;
+      }
+
+      return ret;
+   }
+
+   void work()
+   {
+      std::unique_lock<std::mutex> lock {mutex_};
+      for (;;) {
+         run_cursor* c = nullptr;
+         cv_.wait(lock, [&] { return stop_ || (c = next_cursor()); });
+         if (stop_)
+            return;
+
+         c->reading_ = true;
+         lock.unlock();
+
+         std::unique_ptr<run_cursor::batch> b;
+         std::exception_ptr error;
+         try {
+            b = c->read_batch();
+         } catch (...) {
+            error = std::current_exception();
+         }
+
+         lock.lock();
+         c->reading_ = false;
+         if (error) {
+            c->error_ = error;
+            c->done_ = true;
+         } else if (!b) {
+            c->done_ = true;
+         } else {
+            c->queue_.push_back(std::move(b));
+         }
+
+         cv_.notify_all();
+      }
+   }
+
+public:
+   read_ahead_pool(read_ahead_pool const&) = delete;
+   read_ahead_pool& operator=(read_ahead_pool const&) = delete;
+
+   explicit read_ahead_pool(int threads)
+   {
+      for (auto i = 0; i < threads; ++i)
+         threads_.emplace_back(&read_ahead_pool::work, this);
+   }
+
+   ~read_ahead_pool()
+   {
+      {
+         std::lock_guard<std::mutex> lock {mutex_};
+         stop_ = true;
+      }
+
+      cv_.notify_all();
+      for (auto& t : threads_)
+         t.join();
+   }
+
+   void add(run_cursor& c)
+   {
+      std::lock_guard<std::mutex> lock {mutex_};
+      cursors_.push_back(&c);
+      cv_.notify_all();
+   }
+
+   std::unique_ptr<run_cursor::batch> pop(run_cursor& c)
+   {
+      std::unique_lock<std::mutex> lock {mutex_};
+      cv_.wait(lock, [&] { return !std::empty(c.queue_) || c.done_; });
+      if (!std::empty(c.queue_)) {
+         auto ret = std::move(c.queue_.front());
+         c.queue_.pop_front();
+         cv_.notify_all();
+         return ret;
+      }
+
+      if (c.error_)
+         std::rethrow_exception(c.error_);
+
+      return nullptr;
+   }
+};
+
+std::unique_ptr<run_cursor::batch> run_cursor::pop()
+{
+   return pool_ ? pool_->pop(*this) : read_batch();
+}
+
+auto row_less(array_view<std::string_view const> a, array_view<std::string_view const> b)
+{
+   return std::lexicographical_compare(std::begin(a), std::end(a), std::begin(b), std::end(b));
+}
+
+// Merges the runs, passing each row to f in sorted order. The runs
+// are read ahead by the given number of threads, if any.
+template <class F>
+void
+merge_runs(std::vector<run> const& runs,
+           char sep,
+           int readers,
+           F f)
+{
+   // The pool is declared after the cursors so that it is destroyed
+   // first.
+   std::vector<std::unique_ptr<run_cursor>> cursors;
+   std::unique_ptr<read_ahead_pool> pool;
+   if (readers > 0)
+      pool = std::make_unique<read_ahead_pool>(readers);
+
+   for (auto const& r : runs) {
+      cursors.push_back(std::make_unique<run_cursor>(r.path, sep, pool.get()));
+      if (pool)
+         pool->add(*cursors.back());
+   }
+
+   for (auto& c : cursors)
+      c->load();
+
+   auto const greater = [&](int a, int b)
+      { return row_less(cursors[b]->row(), cursors[a]->row()); };
+
+   std::priority_queue<int, std::vector<int>, decltype(greater)> heap {greater};
+   for (auto i = 0; i < tsvtree::ssize(cursors); ++i)
+      if (!cursors[i]->done())
+         heap.push(i);
+
+   while (!std::empty(heap)) {
+      auto const i = heap.top();
+      heap.pop();
+      f(cursors[i]->row());
+      cursors[i]->next();
+      if (!cursors[i]->done())
+         heap.push(i);
+   }
+}
+
+constexpr auto max_runs = 64;
+
+// Merges groups of runs into longer ones until there are few enough
+// to be merged at once, each run needs a file descriptor and a
+// buffer.
+void
+reduce_runs(std::vector<run>& runs,
+            char sep,
+            int readers,
+            temp_dir& dir)
+{
+   auto n = 0;
+   while (tsvtree::ssize(runs) > max_runs) {
+      phase_timer phase {"premerge"};
+      std::vector<run> merged;
+      for (auto i = 0; i < tsvtree::ssize(runs); i += max_runs) {
+         auto const end = std::min(i + max_runs, tsvtree::ssize(runs));
+         std::vector<run> group(std::begin(runs) + i, std::begin(runs) + end);
+
+         run r {{}, group.front().first, group.front().last, true};
+         for (auto const& g : group) {
+            r.first = std::min(r.first, g.first);
+            r.last = std::max(r.last, g.last);
+         }
+
+         fd_guard fd {dir.create("merged" + std::to_string(n++), r.path)};
+         fd_sink os {fd.fd};
+         std::size_t rows = 0;
+         merge_runs(group, sep, readers, [&](auto const& row) {
+            os << row[0];
+            for (auto j = 1; j < tsvtree::ssize(row); ++j)
+               os << sep << row[j];
+            os << '\n';
+            ++rows;
+         });
+
+         os.flush();
+         phase.add(os.bytes(), rows);
+         merged.push_back(std::move(r));
+      }
+
+      for (auto const& r : runs)
+         if (r.temporary)
+            dir.remove(r.path);
+
+      runs = std::move(merged);
+   }
+}
+
+// Computes whether each node of the merged rows is the last child of
+// its parent, as make_lasts in tsv.cpp but with the prefix lengths
+// read backwards from a file. The flags are written backwards too, in
+// blocks, so that they can be read forwards.
+void
+write_lasts(int lcp_fd,
+            std::uint64_t rows,
+            int max_size,
+            int lasts_fd,
+            std::uint64_t nodes)
+{
+   constexpr std::uint64_t block = 1 << 16;
+
+   std::vector<std::int32_t> pairs;
+   std::vector<char> lasts;
+   lasts.reserve(block + max_size);
+
+   auto end = nodes;
+   auto const flush = [&] {
+      std::reverse(std::begin(lasts), std::end(lasts));
+      end -= std::size(lasts);
+      if (::pwrite(lasts_fd, lasts.data(), std::size(lasts), end) != static_cast<ssize_t>(std::size(lasts)))
+         throw std::runtime_error(std::string {"Write error: "} + std::strerror(errno));
+      lasts.clear();
+   };
+
+   std::vector<char> has_next(max_size + 1);
+   auto prev = 0;
+   for (auto k = rows; k > 0;) {
+      auto const n = std::min(k, block);
+      k -= n;
+      pairs.resize(2 * n);
+      auto const bytes = static_cast<ssize_t>(2 * n * sizeof(std::int32_t));
+      if (::pread(lcp_fd, pairs.data(), bytes, 2 * k * sizeof(std::int32_t)) != bytes)
+         throw std::runtime_error(std::string {"Read error: "} + std::strerror(errno));
+
+      for (auto j = static_cast<std::int64_t>(n) - 1; j >= 0; --j) {
+         auto const l = pairs[2 * j];
+         auto const size = pairs[2 * j + 1];
+         if (l == size)
+            continue;
+
+         for (auto d = size - 1; d >= l; --d)
+            lasts.push_back(!has_next[d]);
+
+         std::fill(std::begin(has_next) + l + 1,
+                   std::begin(has_next) + std::max(l, prev) + 1,
+                   0);
+         has_next[l] = 1;
+         prev = l;
+      }
+
+      if (std::size(lasts) >= block)
+         flush();
+   }
+
+   flush();
+}
+
+// Reads the flags written by write_lasts.
+class lasts_reader {
+private:
+   int fd_;
+   std::vector<char> buffer_;
+   std::size_t begin_ = 0;
+   std::size_t end_ = 0;
+
+public:
+   explicit lasts_reader(int fd) : fd_ {fd}, buffer_(1 << 16) { }
+
+   char const* read(int n)
+   {
+      if (end_ - begin_ < static_cast<std::size_t>(n)) {
+         std::copy(std::begin(buffer_) + begin_, std::begin(buffer_) + end_, std::begin(buffer_));
+         end_ -= begin_;
+         begin_ = 0;
+         if (std::size(buffer_) < static_cast<std::size_t>(n))
+            buffer_.resize(n);
+
+         while (end_ < static_cast<std::size_t>(n)) {
+            auto const r = ::read(fd_, buffer_.data() + end_, std::size(buffer_) - end_);
+            if (r <= 0)
+               throw std::runtime_error("Unexpected end of the temporary file.");
+            end_ += r;
+         }
+      }
+
+      auto const* ret = buffer_.data() + begin_;
+      begin_ += n;
+      return ret;
+   }
+};
+
+// Merges the runs and writes the tree of their rows.
+void
+write_merged_tree(std::vector<run> runs,
+                  tsv_cfg const& op,
+                  std::unique_ptr<temp_dir>& dir,
+                  output_sink& os)
+{
+   // The merging thread is one of --threads, the others read ahead.
+   auto const readers = op.threads - 1;
+   auto const decorate = op.indentation >= 0 && op.decorate;
+   if (!dir && (decorate || tsvtree::ssize(runs) > max_runs))
+      dir = std::make_unique<temp_dir>();
+
+   if (tsvtree::ssize(runs) > max_runs)
+      reduce_runs(runs, op.in_field_sep, readers, *dir);
+
+   // The same as in parse_tree.
+   auto const first = std::min_element(std::begin(runs), std::end(runs),
+      [](auto const& a, auto const& b) { return a.first < b.first; })->first;
+   auto const last = std::max_element(std::begin(runs), std::end(runs),
+      [](auto const& a, auto const& b) { return a.last < b.last; })->last;
+
+   // Sorted input files are checked here, by the first pass over the
+   // merged rows.
+   auto const checked_lcp = [&](row_prefix& prefix, auto const& row) {
+      auto const lcp = prefix.next(row);
+      if (lcp == -1) {
+         std::string line {row[0]};
+         for (auto i = 1; i < tsvtree::ssize(row); ++i)
+            (line += op.in_field_sep) += row[i];
+         throw std::runtime_error("Input is not sorted: " + line);
+      }
+
+      return lcp;
+   };
+
+   std::string lasts_path;
+   std::unique_ptr<fd_guard> lasts_fd;
+   if (decorate) {
+      phase_timer phase {"lasts"};
+
+      std::string lcp_path;
+      fd_guard lcp_fd {dir->create("lcp", lcp_path)};
+      std::uint64_t n = 0;
+      std::uint64_t nodes = 0;
+      auto max_size = 0;
+      {
+         fd_sink lcps {lcp_fd.fd};
+         row_prefix prefix;
+         merge_runs(runs, op.in_field_sep, readers, [&](auto const& row) {
+            std::int32_t const pair[] = {checked_lcp(prefix, row), static_cast<std::int32_t>(std::size(row))};
+            lcps.write(reinterpret_cast<char const*>(pair), sizeof pair);
+            nodes += pair[1] - pair[0];
+            max_size = std::max(max_size, pair[1]);
+            ++n;
+         });
+         lcps.flush();
+      }
+
+      lasts_fd = std::make_unique<fd_guard>(dir->create("lasts", lasts_path));
+      write_lasts(lcp_fd.fd, n, max_size, lasts_fd->fd, nodes);
+      phase.add(0, n);
+   }
+
+   phase_timer phase {"merge"};
+   auto const bytes = os.bytes();
+   std::size_t n = 0;
+
+   sorted_tree_writer writer {op, os};
+   if (first != last)
+      writer.write_root();
+
+   row_prefix prefix;
+   auto const next = [&](auto const& row) {
+      ++n;
+      return checked_lcp(prefix, row);
+   };
+
+   if (decorate) {
+      lasts_reader lasts {lasts_fd->fd};
+      merge_runs(runs, op.in_field_sep, readers, [&](auto const& row) {
+         auto const lcp = next(row);
+         writer.write(row, lcp, lasts.read(tsvtree::ssize(row) - lcp));
+      });
+   } else {
+      merge_runs(runs, op.in_field_sep, readers, [&](auto const& row) {
+         writer.write(row, next(row));
+      });
+   }
+
+   phase.add(os.bytes() - bytes, n);
+}
+
+void
+write_tree_external(std::vector<std::string> const& files,
+                    tsv_cfg const& op,
+                    std::size_t memory_limit,
+                    output_sink& os)
+{
+   remove_temp_dirs_on_signal();
+
+   std::unique_ptr<temp_dir> dir;
+   std::vector<run> runs;
+
+   // The input files are read one after the other.
+   std::size_t k = 0;
+   auto reader = std::make_unique<line_reader>(files.front());
+   auto const next_line = [&](std::string_view& line) {
+      while (!reader->next(line, '\n')) {
+         if (++k == std::size(files))
+            return false;
+
+         reader = std::make_unique<line_reader>(files[k]);
+      }
+
+      return true;
+   };
+
+   // The chunk does not reallocate while it is filled.
+   std::string chunk;
+   chunk.reserve(memory_limit);
+   std::size_t fields = 0;
+   std::size_t rows = 0;
+
+   std::string_view line;
+   for (;;) {
+      auto const more = next_line(line);
+      if (more) {
+         chunk += line;
+         chunk += '\n';
+         fields += std::count(std::begin(line), std::end(line), op.in_field_sep) + 1;
+         ++rows;
+         if (chunk_memory(std::size(chunk), fields, rows) < memory_limit)
+            continue;
+      }
+
+      if (!more && std::empty(runs)) {
+         // Everything fits.
+         write_tree(chunk, op, os);
+         return;
+      }
+
+      if (!more && std::empty(chunk))
+         break;
+
+      if (!dir)
+         dir = std::make_unique<temp_dir>();
+
+      phase_timer phase {"spill"};
+      phase.add(std::size(chunk), rows);
+      runs.push_back(write_run(chunk, op, *dir, tsvtree::ssize(runs)));
+      chunk.clear();
+      fields = 0;
+      rows = 0;
+
+      if (!more)
+         break;
+   }
+
+   write_merged_tree(std::move(runs), op, dir, os);
+}
+
+void
+write_sorted_files(std::vector<std::string> const& files,
+                   tsv_cfg const& op,
+                   output_sink& os)
+{
+   remove_temp_dirs_on_signal();
+
+   std::vector<run> runs;
+   for (auto const& f : files) {
+      line_reader reader {f};
+      std::string last;
+      if (!reader.last_line(last, '\n'))
+         throw std::runtime_error("Sorted input in more than one file must be read from regular files.");
+
+      auto const last_row = split_line(last, op.in_field_sep);
+      if (std::empty(last_row))
+         continue;
+
+      run r {f, {}, std::string {last_row.front()}, false};
+      std::string_view line;
+      while (reader.next(line, '\n')) {
+         auto const row = split_line(line, op.in_field_sep);
+         if (!std::empty(row)) {
+            r.first = row.front();
+            break;
+         }
+      }
+
+      runs.push_back(std::move(r));
+   }
+
+   if (std::empty(runs))
+      return;
+
+   std::unique_ptr<temp_dir> dir;
+   write_merged_tree(std::move(runs), op, dir, os);
+}
+
+} // tsvtree
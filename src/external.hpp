@@ -0,0 +1,57 @@
+/* Copyright (c) 2020 - 2021 Marcelo Zimbres Silva (mzimbres at gmail dot com)
+ *
+ * This file is part of tsvtree.
+ *
+ * tsvtree is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tsvtree is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tsvtree.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstddef>
+
+#include "tsv.hpp"
+
+namespace tsvtree
+{
+
+class output_sink;
+
+// Writes the tree of tsv files keeping about memory_limit bytes of
+// rows in memory. The files are read one after the other, as if
+// concatenated, in chunks of that size that are sorted and written as
+// runs to a temporary directory ($TMPDIR or /tmp). The runs are then
+// merged and the nodes of each row written as they come, as for sorted
+// input. The decorated tree needs to know whether a node is the last
+// child of its parent, this is computed first in a backwards pass over
+// the prefix lengths of the merged rows. Input that fits in one chunk
+// is processed in memory as usual.
+void
+write_tree_external(std::vector<std::string> const& files,
+                    tsv_cfg const& op,
+                    std::size_t memory_limit,
+                    output_sink& os);
+
+// Writes the tree of tsv files that are each sorted, by merging their
+// rows as for the runs above, so that they don't have to be sorted
+// again. With more than one thread, each file is read and tokenized
+// ahead by a thread of its own. The files must be regular files since
+// their last line is needed in advance.
+void
+write_sorted_files(std::vector<std::string> const& files,
+                   tsv_cfg const& op,
+                   output_sink& os);
+
+} // tsvtree
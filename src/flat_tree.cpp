@@ -0,0 +1,770 @@
+/* Copyright (c) 2020 - 2021 Marcelo Zimbres Silva (mzimbres at gmail dot com)
+ *
+ * This file is part of tsvtree.
+ *
+ * tsvtree is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tsvtree is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tsvtree.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "flat_tree.hpp"
+
+#include <atomic>
+#include <thread>
+#include <limits>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+
+#include "tree_parser.hpp"
+#include "output.hpp"
+#include "stats.hpp"
+#include "pattern.hpp"
+
+namespace tsvtree
+{
+
+// Layout of the binary format. The header is followed by the arrays
+// of the tree, each starting at the offset given in the header, which
+// is relative to the beginning of the file and a multiple of 8. The
+// integers are stored in the byte order of the machine that wrote the
+// file, which is checked on reading.
+enum section
+{ parent_sec
+, first_child_sec
+, next_sibling_sec
+, subtree_size_sec
+, depth_sec
+, leaf_counter_sec
+, name_offset_sec
+, names_sec
+, n_sections
+};
+
+struct bin_header {
+   char magic[8];
+   std::uint32_t version;
+   std::uint32_t byte_order;
+   std::int64_t size;
+   std::int64_t max_depth;
+   std::uint64_t names_size;
+   std::uint64_t offsets[n_sections];
+};
+
+constexpr char bin_magic[8] = {'\x7f', 't', 's', 'v', 't', 'r', 'e', 'e'};
+constexpr std::uint32_t bin_version = 1;
+constexpr std::uint32_t bin_byte_order = 0x01020304;
+
+auto align8(std::uint64_t n) noexcept
+   { return (n + 7) & ~std::uint64_t {7}; }
+
+bool is_binary(std::string_view data) noexcept
+{
+   return std::size(data) >= sizeof bin_magic
+       && std::memcmp(data.data(), bin_magic, sizeof bin_magic) == 0;
+}
+
+void write_binary(flat_tree const& t, output_sink& os)
+{
+   auto const n = static_cast<std::uint64_t>(t.size());
+
+   // The names are contiguous in both owned and mapped trees.
+   std::vector<std::uint64_t> name_offset(n + 1);
+   for (std::uint64_t i = 0; i < n; ++i)
+      name_offset[i + 1] = name_offset[i] + std::size(t.name(i));
+
+   std::uint64_t const sizes[n_sections] =
+   { n * sizeof(int)
+   , n * sizeof(int)
+   , n * sizeof(int)
+   , n * sizeof(int)
+   , n * sizeof(int)
+   , n * sizeof(int)
+   , (n + 1) * sizeof(std::uint64_t)
+   , name_offset.back()
+   };
+
+   bin_header h {};
+   std::memcpy(h.magic, bin_magic, sizeof bin_magic);
+   h.version = bin_version;
+   h.byte_order = bin_byte_order;
+   h.size = t.size();
+   h.max_depth = t.max_depth();
+   h.names_size = name_offset.back();
+
+   auto offset = align8(sizeof h);
+   for (auto i = 0; i < n_sections; ++i) {
+      h.offsets[i] = offset;
+      offset = align8(offset + sizes[i]);
+   }
+
+   auto written = static_cast<std::uint64_t>(sizeof h);
+   os.write(reinterpret_cast<char const*>(&h), sizeof h);
+
+   auto const write = [&](int sec, void const* p) {
+      char const zeros[8] = {};
+      os.write(zeros, h.offsets[sec] - written);
+      os.write(static_cast<char const*>(p), sizes[sec]);
+      written = h.offsets[sec] + sizes[sec];
+   };
+
+   // The arrays are written element by element from the accessors,
+   // the tree may itself be a mapped one.
+   std::vector<int> buffer(n);
+   auto const write_ints = [&](int sec, auto f) {
+      for (std::uint64_t i = 0; i < n; ++i)
+         buffer[i] = f(static_cast<int>(i));
+      write(sec, buffer.data());
+   };
+
+   write_ints(parent_sec, [&](int i) { return t.parent(i); });
+   write_ints(first_child_sec, [&](int i) { return t.first_child(i); });
+   write_ints(next_sibling_sec, [&](int i) { return t.next_sibling(i); });
+   write_ints(subtree_size_sec, [&](int i) { return t.subtree_size(i); });
+   write_ints(depth_sec, [&](int i) { return t.depth(i); });
+   write_ints(leaf_counter_sec, [&](int i) { return t.leaf_counter(i); });
+
+   write(name_offset_sec, name_offset.data());
+
+   write(names_sec, n == 0 ? nullptr : t.name(0).data());
+}
+
+flat_tree::flat_tree(std::string_view str, oconfig const& cfg)
+{
+   auto const bin = cfg.fmt == oconfig::format::bin;
+   auto const comp_bin = cfg.fmt == oconfig::format::comp_bin;
+   phase_timer phase {bin ? "map" : comp_bin ? "decode" : "parse"};
+   if (bin)
+      map(str);
+   else if (comp_bin)
+      decode(str);
+   else
+      parse(str, cfg);
+
+   phase.add(std::size(str), size());
+   count_nodes_per_depth(depth_);
+}
+
+void flat_tree::parse(std::string_view str, oconfig const& cfg)
+{
+   node_reader reader {str, cfg};
+   build(reader, 0);
+}
+
+template <class Reader>
+void flat_tree::build(Reader& reader, std::size_t size_hint)
+{
+   auto& s = storage_;
+   s.parent.reserve(size_hint);
+   s.first_child.reserve(size_hint);
+   s.next_sibling.reserve(size_hint);
+   s.subtree_size.reserve(size_hint);
+   s.depth.reserve(size_hint);
+   s.name_offset.reserve(size_hint + 1);
+   s.name_offset.push_back(0);
+
+   // The nodes on the path to the last node read.
+   std::vector<int> open;
+
+   int depth;
+   std::string_view name;
+   while (reader.next(depth, name)) {
+      auto const i = tsvtree::ssize(s.parent);
+
+      // The node at the same depth, if any, is the previous sibling.
+      auto const prev = tsvtree::ssize(open) > depth ? open[depth] : -1;
+      while (tsvtree::ssize(open) > depth) {
+         s.subtree_size[open.back()] = i - open.back();
+         open.pop_back();
+      }
+
+      auto const parent = std::empty(open) ? -1 : open.back();
+      if (prev != -1)
+         s.next_sibling[prev] = i;
+      else if (parent != -1)
+         s.first_child[parent] = i;
+
+      s.parent.push_back(parent);
+      s.first_child.push_back(-1);
+      s.next_sibling.push_back(-1);
+      s.subtree_size.push_back(1);
+      s.depth.push_back(depth);
+      s.names += name;
+      s.name_offset.push_back(std::size(s.names));
+      open.push_back(i);
+   }
+
+   for (auto k : open)
+      s.subtree_size[k] = tsvtree::ssize(s.parent) - k;
+
+   s.leaf_counter.resize(std::size(s.parent));
+
+   parent_ = s.parent;
+   first_child_ = s.first_child;
+   next_sibling_ = s.next_sibling;
+   subtree_size_ = s.subtree_size;
+   depth_ = s.depth;
+   leaf_counter_ = s.leaf_counter;
+   name_offset_ = s.name_offset;
+   names_ = s.names.data();
+   max_depth_ = reader.max_depth();
+}
+
+void flat_tree::map(std::string_view bin)
+{
+   auto const invalid = [] { throw std::runtime_error("Invalid binary tree."); };
+
+   bin_header h;
+   if (std::size(bin) < sizeof h || !is_binary(bin))
+      invalid();
+
+   std::memcpy(&h, bin.data(), sizeof h);
+   if (h.version != bin_version)
+      throw std::runtime_error("Unsupported binary tree version.");
+
+   if (h.byte_order != bin_byte_order)
+      throw std::runtime_error("Binary tree written on a machine with a different byte order.");
+
+   if (reinterpret_cast<std::uintptr_t>(bin.data()) % alignof(std::uint64_t) != 0)
+      invalid();
+
+   if (h.size < 0 || h.size > std::numeric_limits<int>::max())
+      invalid();
+
+   auto const n = static_cast<std::uint64_t>(h.size);
+   auto const section = [&](int sec, std::uint64_t bytes) {
+      auto const off = h.offsets[sec];
+      if (off % 8 != 0 || off > std::size(bin) || bytes > std::size(bin) - off)
+         invalid();
+
+      return bin.data() + off;
+   };
+
+   auto const ints = [&](int sec) {
+      auto const* p = section(sec, n * sizeof(int));
+      return array_view<int const> {reinterpret_cast<int const*>(p), static_cast<int>(n)};
+   };
+
+   if (h.max_depth < 0 || h.max_depth > std::numeric_limits<int>::max())
+      invalid();
+
+   parent_ = ints(parent_sec);
+   first_child_ = ints(first_child_sec);
+   next_sibling_ = ints(next_sibling_sec);
+   subtree_size_ = ints(subtree_size_sec);
+   depth_ = ints(depth_sec);
+   leaf_counter_ = ints(leaf_counter_sec);
+
+   auto const* offsets = section(name_offset_sec, (n + 1) * sizeof(std::uint64_t));
+   name_offset_ = {reinterpret_cast<std::uint64_t const*>(offsets), static_cast<int>(n + 1)};
+   names_ = section(names_sec, h.names_size);
+   max_depth_ = static_cast<int>(h.max_depth);
+
+   // The values are used as indices without further checks, so that
+   // they must be valid. The nodes are stored in preorder, the links
+   // point forward and into the subtree of the node, which rules out
+   // cycles.
+   auto const size = static_cast<int>(n);
+   for (auto i = 0; i < size; ++i) {
+      auto const end = i + static_cast<std::int64_t>(subtree_size_[i]);
+      auto const child = first_child_[i];
+      auto const sibling = next_sibling_[i];
+      if (parent_[i] < -1 || parent_[i] >= i
+          || subtree_size_[i] < 1 || end > size
+          || (child != -1 && (child <= i || child >= end))
+          || (sibling != -1 && (sibling < end || sibling >= size))
+          || depth_[i] < 0 || depth_[i] > max_depth_
+          || leaf_counter_[i] < 0
+          || name_offset_[i] > name_offset_[i + 1])
+         invalid();
+   }
+
+   if (name_offset_[0] != 0 || name_offset_[size] > h.names_size)
+      invalid();
+
+   counted_ = true;
+}
+
+// Layout of the compressed binary format. All integers are varints,
+// i.e. 7 bits per byte starting with the least significant ones, the
+// high bit set on all bytes but the last, so that the format does not
+// depend on the byte order.
+//
+//    header: magic, version, flags, number of nodes, size of the names
+//    blocks: number of nodes, size of the data, data[, checksum]
+//    node:   up, prefix, size of the suffix, suffix
+//
+// The depth of a node is the depth of the previous node plus one minus
+// up, and its name is made of the first prefix bytes of the previous
+// name on the same depth followed by the suffix. The checksum of a
+// block is the Adler-32 of its data in four bytes, little endian.
+constexpr char comp_bin_magic[8] = {'\x7f', 't', 's', 'v', 'c', 'o', 'm', 'p'};
+constexpr std::uint64_t comp_bin_version = 1;
+constexpr std::uint64_t comp_bin_checksums = 1;
+constexpr std::size_t comp_bin_block_size = 1 << 16;
+
+bool is_comp_binary(std::string_view data) noexcept
+{
+   return std::size(data) >= sizeof comp_bin_magic
+       && std::memcmp(data.data(), comp_bin_magic, sizeof comp_bin_magic) == 0;
+}
+
+void put_varint(std::string& out, std::uint64_t n)
+{
+   while (n >= 0x80) {
+      out += static_cast<char>(n | 0x80);
+      n >>= 7;
+   }
+
+   out += static_cast<char>(n);
+}
+
+std::uint32_t adler32(std::string_view data) noexcept
+{
+   // The sums are reduced before they can overflow, see zlib.
+   constexpr std::uint32_t mod = 65521;
+   constexpr std::size_t nmax = 5552;
+
+   std::uint32_t a = 1;
+   std::uint32_t b = 0;
+   while (!std::empty(data)) {
+      auto const n = std::min(std::size(data), nmax);
+      for (std::size_t i = 0; i < n; ++i) {
+         a += static_cast<unsigned char>(data[i]);
+         b += a;
+      }
+
+      a %= mod;
+      b %= mod;
+      data.remove_prefix(n);
+   }
+
+   return b << 16 | a;
+}
+
+void write_comp_binary(flat_tree const& t, output_sink& os, bool checksums)
+{
+   auto const n = t.size();
+   std::uint64_t names_size = 0;
+   for (auto i = 0; i < n; ++i)
+      names_size += std::size(t.name(i));
+
+   std::string header {comp_bin_magic, sizeof comp_bin_magic};
+   put_varint(header, comp_bin_version);
+   put_varint(header, checksums ? comp_bin_checksums : 0);
+   put_varint(header, n);
+   put_varint(header, names_size);
+   os << header;
+
+   std::string block;
+   std::string head;
+   auto nodes = 0;
+   auto const flush = [&] {
+      head.clear();
+      put_varint(head, nodes);
+      put_varint(head, std::size(block));
+      os << head << block;
+
+      if (checksums) {
+         auto const sum = adler32(block);
+         for (auto k = 0; k < 4; ++k)
+            os << static_cast<char>(sum >> (8 * k));
+      }
+
+      block.clear();
+      nodes = 0;
+   };
+
+   // The previous name on each depth.
+   std::vector<std::string_view> prev(t.max_depth() + 1);
+   auto prev_depth = -1;
+   for (auto i = 0; i < n; ++i) {
+      auto const d = t.depth(i);
+      auto const name = t.name(i);
+      auto const& p = prev[d];
+      auto const m = std::min(std::size(p), std::size(name));
+      std::size_t prefix = 0;
+      while (prefix < m && p[prefix] == name[prefix])
+         ++prefix;
+
+      put_varint(block, prev_depth + 1 - d);
+      put_varint(block, prefix);
+      put_varint(block, std::size(name) - prefix);
+      block.append(name.data() + prefix, std::size(name) - prefix);
+
+      prev[d] = name;
+      prev_depth = d;
+      ++nodes;
+      if (std::size(block) >= comp_bin_block_size)
+         flush();
+   }
+
+   if (nodes != 0)
+      flush();
+}
+
+// Reads the nodes of a tree in compressed binary format, like
+// node_reader. The names are assembled in a buffer per depth, that is
+// reused from node to node.
+class comp_bin_reader {
+private:
+   char const* p_;
+   char const* end_;
+   char const* file_end_;
+
+   // The end of the data of the current block and where the next one
+   // begins, after the checksum.
+   char const* block_end_;
+   char const* next_block_;
+
+   std::uint64_t size_ = 0;
+   std::uint64_t names_size_ = 0;
+   std::uint64_t read_ = 0;
+   std::uint64_t block_nodes_ = 0;
+   bool checksums_ = false;
+   int depth_ = -1;
+   int max_depth_ = 0;
+   std::vector<std::string> names_;
+
+   [[noreturn]] static void invalid()
+      { throw std::runtime_error("Invalid compressed binary tree."); }
+
+   std::uint64_t varint()
+   {
+      std::uint64_t ret = 0;
+      for (auto shift = 0; shift < 64; shift += 7) {
+         if (p_ == end_)
+            invalid();
+
+         auto const c = static_cast<unsigned char>(*p_++);
+         ret |= std::uint64_t {c & 0x7fu} << shift;
+         if (c < 0x80)
+            return ret;
+      }
+
+      invalid();
+   }
+
+   void next_block()
+   {
+      if (p_ != block_end_)
+         invalid();
+
+      p_ = next_block_;
+      end_ = file_end_;
+      block_nodes_ = varint();
+      auto const n = varint();
+      auto const tail = checksums_ ? 4 : 0;
+      if (block_nodes_ == 0 || n + tail > static_cast<std::uint64_t>(end_ - p_))
+         invalid();
+
+      block_end_ = p_ + n;
+      next_block_ = block_end_ + tail;
+      if (checksums_) {
+         std::uint32_t sum = 0;
+         for (auto k = 0; k < 4; ++k)
+            sum |= std::uint32_t {static_cast<unsigned char>(block_end_[k])} << (8 * k);
+
+         if (sum != adler32({p_, static_cast<std::size_t>(n)}))
+            throw std::runtime_error("Checksum mismatch in compressed binary tree.");
+      }
+
+      // The varints of a node are not read past its block.
+      end_ = block_end_;
+   }
+
+public:
+   explicit comp_bin_reader(std::string_view data)
+   : p_ {data.data()}
+   , end_ {data.data() + std::size(data)}
+   , file_end_ {end_}
+   {
+      if (!is_comp_binary(data))
+         invalid();
+
+      p_ += sizeof comp_bin_magic;
+      if (varint() != comp_bin_version)
+         throw std::runtime_error("Unsupported compressed binary tree version.");
+
+      checksums_ = (varint() & comp_bin_checksums) != 0;
+      size_ = varint();
+      names_size_ = varint();
+      if (size_ > static_cast<std::uint64_t>(std::numeric_limits<int>::max()))
+         invalid();
+
+      block_end_ = p_;
+      next_block_ = p_;
+   }
+
+   auto size() const noexcept { return size_; }
+   auto names_size() const noexcept { return names_size_; }
+   auto max_depth() const noexcept { return max_depth_; }
+
+   bool next(int& depth, std::string_view& name)
+   {
+      if (read_ == size_) {
+         if (p_ != block_end_ || next_block_ != file_end_)
+            invalid();
+
+         return false;
+      }
+
+      if (block_nodes_ == 0)
+         next_block();
+
+      // Only the first node is on depth 0.
+      auto const up = varint();
+      if (up > static_cast<std::uint64_t>(depth_) && read_ != 0)
+         invalid();
+
+      depth_ = depth_ + 1 - static_cast<int>(up);
+      if (depth_ != 0 && read_ == 0)
+         invalid();
+
+      if (depth_ == tsvtree::ssize(names_))
+         names_.emplace_back();
+
+      auto& s = names_[depth_];
+      auto const prefix = varint();
+      auto const n = varint();
+      if (prefix > std::size(s) || n > static_cast<std::uint64_t>(end_ - p_))
+         invalid();
+
+      s.resize(prefix);
+      s.append(p_, n);
+      p_ += n;
+
+      --block_nodes_;
+      ++read_;
+      max_depth_ = std::max(max_depth_, depth_);
+      depth = depth_;
+      name = s;
+      return true;
+   }
+};
+
+void flat_tree::decode(std::string_view comp)
+{
+   comp_bin_reader reader {comp};
+   storage_.names.reserve(reader.names_size());
+   build(reader, reader.size());
+}
+
+int flat_tree::at(std::vector<int> const& coord) const
+{
+   if (std::empty(coord) || empty() || coord.front() != 0)
+      return -1;
+
+   auto ret = 0;
+   for (auto i = 1; i < tsvtree::ssize(coord); ++i) {
+      if (coord[i] < 0)
+         return ret;
+
+      auto child = first_child(ret);
+      for (auto k = 0; k < coord[i] && child != -1; ++k)
+         child = next_sibling(child);
+
+      if (child == -1)
+         return ret;
+
+      ret = child;
+   }
+
+   return ret;
+}
+
+// Adds the leaf counters of the nodes in [begin, end) to their
+// parents in the same range. The range is made of whole subtrees.
+void count_leaves(array_view<int const> parent,
+                  array_view<int const> first_child,
+                  std::vector<int>& counter,
+                  int begin,
+                  int end)
+{
+   for (auto i = end - 1; i > begin; --i)
+      if (parent[i] >= begin)
+         counter[parent[i]] += first_child[i] == -1 ? 1 : counter[i];
+}
+
+void flat_tree::load_leaf_counters(int threads)
+{
+   if (counted_)
+      return;
+
+   phase_timer phase {"leaf_counters"};
+   auto& counter = storage_.leaf_counter;
+   auto const n = size();
+
+   // Each thread takes a few subtrees of about the same size.
+   auto const grain = std::max(n / (8 * std::max(threads, 1)), 1 << 16);
+   if (threads <= 1 || n <= grain) {
+      count_leaves(parent_, first_child_, counter, 0, n);
+      counted_ = true;
+      return;
+   }
+
+   // The nodes whose subtree is larger than the grain are counted at
+   // the end, the subtrees below them are grouped in ranges of
+   // consecutive siblings in pre-order.
+   std::vector<int> top;
+   std::vector<std::pair<int, int>> ranges;
+   for (auto i = 0; i < n;) {
+      auto const s = subtree_size_[i];
+      if (s > grain) {
+         top.push_back(i++);
+         continue;
+      }
+
+      if (!std::empty(ranges) && ranges.back().second == i
+          && ranges.back().second - ranges.back().first + s <= grain)
+         ranges.back().second += s;
+      else
+         ranges.push_back({i, i + s});
+
+      i += s;
+   }
+
+   // The ranges are taken from a shared counter, threads that finish
+   // early continue with the remaining ones.
+   std::atomic<int> next {0};
+   auto const work = [&] {
+      for (auto k = next++; k < tsvtree::ssize(ranges); k = next++)
+         count_leaves(parent_, first_child_, counter, ranges[k].first, ranges[k].second);
+   };
+
+   std::vector<std::thread> workers;
+   for (auto i = 1; i < std::min(threads, tsvtree::ssize(ranges)); ++i)
+      workers.emplace_back(work);
+
+   work();
+   for (auto& t : workers)
+      t.join();
+
+   for (auto it = std::rbegin(top); it != std::rend(top); ++it)
+      for (auto c = first_child_[*it]; c != -1; c = next_sibling_[c])
+         counter[*it] += is_leaf(c) ? 1 : counter[c];
+
+   counted_ = true;
+}
+
+std::vector<char> select_nodes(flat_tree const& t, path_filter const& f)
+{
+   phase_timer phase {"select"};
+   auto const n = t.size();
+   std::vector<char> ret(n);
+
+   // The state of the path to the node at each depth.
+   std::vector<path_filter::state> states(t.max_depth() + 1);
+   for (auto i = 0; i < n;) {
+      auto const d = t.depth(i);
+      auto const s = f.next(d == 0 ? f.start() : states[d - 1], t.name(i));
+      if (f.pruned(s)) {
+         i += t.subtree_size(i);
+         continue;
+      }
+
+      states[d] = s;
+      if (f.selected(s))
+         ret[i] = node_selected;
+      ++i;
+   }
+
+   // Children come after their parents.
+   for (auto i = n - 1; i > 0; --i)
+      if (ret[i] != 0 && t.parent(i) != -1)
+         ret[t.parent(i)] |= node_selected | node_selected_children;
+
+   phase.add(0, n);
+   return ret;
+}
+
+std::vector<int>
+count_selected_leaves(flat_tree const& t, std::vector<char> const& selection)
+{
+   std::vector<int> ret(t.size());
+   for (auto i = t.size() - 1; i > 0; --i) {
+      if (selection[i] == 0 || t.parent(i) == -1)
+         continue;
+
+      auto const leaf = (selection[i] & node_selected_children) == 0;
+      ret[t.parent(i)] += leaf ? 1 : ret[i];
+   }
+
+   return ret;
+}
+
+//-------------------------------------------------------------------
+flat_tsv_traversal::flat_tsv_traversal(flat_tree const& t,
+                                       int root,
+                                       int depth,
+                                       std::vector<char> const* selection)
+: tree_ {&t}
+, selection_ {selection && !std::empty(*selection) ? selection->data() : nullptr}
+, node_ {root == -1 ? 0 : root}
+, end_ {root == -1 ? 0 : root + t.subtree_size(root)}
+, root_depth_ {root == -1 ? 0 : t.depth(root)}
+, max_depth_ {depth}
+{
+   if (root == -1)
+      return;
+
+   if (!kept(root)) {
+      node_ = end_;
+      return;
+   }
+
+   path_.push_back(root);
+
+   // The coordinate of the root is given by the position of each
+   // ancestor among its siblings.
+   for (auto n = root; t.parent(n) != -1; n = t.parent(n)) {
+      auto k = 0;
+      for (auto c = t.first_child(t.parent(n)); c != n; c = t.next_sibling(c))
+         ++k;
+      code_.push_back(k);
+   }
+
+   code_.push_back(0);
+   std::reverse(std::begin(code_), std::end(code_));
+}
+
+void flat_tsv_traversal::step()
+{
+   // Skips the descendants of nodes at the bottom and of those that
+   // are not kept.
+   auto const skip = !kept(node_) || at_bottom();
+   node_ += skip ? tree_->subtree_size(node_) : 1;
+   if (done())
+      return;
+
+   path_.resize(tree_->depth(node_) - root_depth_);
+   path_.push_back(node_);
+
+   auto const d = tree_->depth(node_);
+   if (tree_->first_child(tree_->parent(node_)) == node_) {
+      code_.resize(d);
+      code_.push_back(0);
+   } else {
+      code_.resize(d + 1);
+      ++code_[d];
+   }
+}
+
+void flat_tsv_traversal::next()
+{
+   // The nodes that are not kept are passed to keep the coordinates.
+   do {
+      step();
+   } while (!done() && !kept(node_));
+}
+
+} // tsvtree
@@ -0,0 +1,215 @@
+/* Copyright (c) 2020 - 2021 Marcelo Zimbres Silva (mzimbres at gmail dot com)
+ *
+ * This file is part of tsvtree.
+ *
+ * tsvtree is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tsvtree is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tsvtree.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <limits>
+#include <string_view>
+
+#include "utils.hpp"
+#include "tree_utils.hpp"
+
+namespace tsvtree
+{
+
+class output_sink;
+class path_filter;
+
+// Immutable representation of a tree. The nodes are identified by
+// their position in pre-order, which is also the order in which they
+// appear in the tsv and tree files, so that the subtree of node i is
+// the range [i, i + subtree_size(i)). The names are stored in a single
+// string. Absent nodes are represented by -1.
+//
+// The arrays are either owned, when the tree is parsed from text, or
+// refer to a tree in binary format (see write_binary), in which case
+// the input has to outlive the tree.
+class flat_tree {
+private:
+   struct storage {
+      std::vector<int> parent;
+      std::vector<int> first_child;
+      std::vector<int> next_sibling;
+      std::vector<int> subtree_size;
+      std::vector<int> depth;
+      std::vector<int> leaf_counter;
+      std::vector<std::uint64_t> name_offset;
+      std::string names;
+   };
+
+   storage storage_;
+
+   array_view<int const> parent_;
+   array_view<int const> first_child_;
+   array_view<int const> next_sibling_;
+   array_view<int const> subtree_size_;
+   array_view<int const> depth_;
+   array_view<int const> leaf_counter_;
+   array_view<std::uint64_t const> name_offset_;
+   char const* names_ = nullptr;
+   int max_depth_ = 0;
+   bool counted_ = false;
+
+   void parse(std::string_view str, oconfig const& cfg);
+   void map(std::string_view bin);
+   void decode(std::string_view comp);
+
+   // Builds the arrays from the nodes in pre-order given by the reader.
+   template <class Reader>
+   void build(Reader& reader, std::size_t size_hint);
+
+public:
+   flat_tree(flat_tree const&) = delete;
+   flat_tree& operator=(flat_tree const&) = delete;
+   flat_tree(flat_tree&&) = delete;
+   flat_tree& operator=(flat_tree&&) = delete;
+   flat_tree(std::string_view str, oconfig const& cfg);
+
+   auto size() const noexcept { return parent_.size(); }
+   auto empty() const noexcept { return parent_.empty(); }
+   auto max_depth() const noexcept { return max_depth_; }
+
+   auto parent(int i) const noexcept { return parent_[i]; }
+   auto first_child(int i) const noexcept { return first_child_[i]; }
+   auto next_sibling(int i) const noexcept { return next_sibling_[i]; }
+   auto subtree_size(int i) const noexcept { return subtree_size_[i]; }
+   auto depth(int i) const noexcept { return depth_[i]; }
+   auto leaf_counter(int i) const noexcept { return leaf_counter_[i]; }
+   auto is_leaf(int i) const noexcept { return first_child_[i] == -1; }
+
+   std::string_view name(int i) const noexcept
+   {
+      return {names_ + name_offset_[i],
+              static_cast<std::size_t>(name_offset_[i + 1] - name_offset_[i])};
+   }
+
+   // Returns the node at the specified position in the tree where [0]
+   // is the root node. If the coordinate goes beyond the tree the last
+   // existing node on its path is returned.
+   int at(std::vector<int> const& coord) const;
+
+   // Sets the number of leaf nodes reachable from each node. Computed
+   // with a backwards scan since children come after their parents.
+   // With more than one thread the subtrees below the large nodes are
+   // scanned in parallel. Binary trees have them already.
+   void load_leaf_counters(int threads = 1);
+};
+
+// Writes the tree in binary format, with its leaf counters. The file
+// has a header followed by the arrays of the tree, see flat_tree.cpp,
+// and can be used without parsing by mapping it into memory.
+void write_binary(flat_tree const& t, output_sink& os);
+
+// Whether the data starts with the header of a binary tree.
+bool is_binary(std::string_view data) noexcept;
+
+// Writes the tree in compressed binary format (comp-bin), a portable
+// and smaller encoding of the comp format: each node is stored as how
+// many levels it goes up from the depth below the previous node and its
+// name front coded against the previous name on its depth, as varints
+// and bytes. The nodes are grouped in blocks that can carry a checksum.
+// See flat_tree.cpp.
+void write_comp_binary(flat_tree const& t, output_sink& os, bool checksums);
+
+// Whether the data starts with the header of a compressed binary tree.
+bool is_comp_binary(std::string_view data) noexcept;
+
+// Flags of the nodes in the result of select_nodes.
+enum : char { node_selected = 1, node_selected_children = 2 };
+
+// Marks the nodes kept by the filter, i.e. the selected ones and their
+// ancestors, and the nodes that have a child that is kept. The subtree
+// of a node that can not be selected is skipped without visiting it.
+std::vector<char> select_nodes(flat_tree const& t, path_filter const& f);
+
+// Like flat_tree::load_leaf_counters but only with the nodes kept in
+// the result of select_nodes.
+std::vector<int>
+count_selected_leaves(flat_tree const& t, std::vector<char> const& selection);
+
+// Visits the subtree rooted at a node in the same order as it appears
+// in the tsv file, descending at most depth levels. Keeps track of the
+// path and coordinate of the current node, so that they don't have to
+// be stored on every node.
+//
+// When given the result of select_nodes, only the nodes that are kept
+// are visited, an empty one selects all nodes. The coordinates are
+// still the ones in the whole tree.
+class flat_tsv_traversal {
+private:
+   flat_tree const* tree_;
+   char const* selection_;
+   int node_;
+   int end_;
+   int root_depth_;
+   int max_depth_;
+   std::vector<int> path_;
+   std::vector<int> code_;
+
+   auto kept(int i) const noexcept
+      { return !selection_ || selection_[i] != 0; }
+
+   void step();
+
+public:
+   flat_tsv_traversal(flat_tree const& t,
+                      int root,
+                      int depth = std::numeric_limits<int>::max(),
+                      std::vector<char> const* selection = nullptr);
+
+   auto done() const noexcept { return node_ >= end_; }
+   auto node() const noexcept { return node_; }
+
+   // Depth relative to the root of the traversal.
+   auto depth() const noexcept { return tsvtree::ssize(path_) - 1; }
+
+   // Whether the current node is the last child of its parent that is
+   // visited.
+   bool last() const noexcept
+   {
+      auto i = tree_->next_sibling(node_);
+      while (i != -1 && !kept(i))
+         i = tree_->next_sibling(i);
+
+      return i == -1;
+   }
+
+   // Whether the current node has no children that are visited or is
+   // at the maximum depth.
+   auto at_bottom() const noexcept
+   {
+      if (depth() >= max_depth_)
+         return true;
+
+      return selection_ ? (selection_[node_] & node_selected_children) == 0
+                        : tree_->is_leaf(node_);
+   }
+
+   // The nodes from the root of the traversal to the current node.
+   auto const& path() const noexcept { return path_; }
+
+   // The coordinate of the current node in the tree.
+   auto const& code() const noexcept { return code_; }
+
+   void next();
+};
+
+} // tsvtree
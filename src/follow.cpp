@@ -0,0 +1,123 @@
+/* Copyright (c) 2020 - 2021 Marcelo Zimbres Silva (mzimbres at gmail dot com)
+ *
+ * This file is part of tsvtree.
+ *
+ * tsvtree is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tsvtree is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tsvtree.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "follow.hpp"
+
+#include <memory>
+#include <limits>
+#include <utility>
+
+#include "tree.hpp"
+#include "input.hpp"
+#include "output.hpp"
+#include "utils.hpp"
+
+namespace tsvtree
+{
+
+// Writes the whole tree as the tsv builder does, including the root
+// node that is added when there are more than one.
+void write_full_tree(tree const& t, tsv_cfg const& op, output_sink& os)
+{
+   auto const& roots = t.roots();
+   auto const shift = tsvtree::ssize(roots) > 1 ? 1 : 0;
+   if (shift != 0) {
+      write_tree_line(os, "Root", 0, op.indentation, op.out_field_sep, {}, op.decorate);
+      os << op.out_line_break;
+   }
+
+   auto const decorate = op.indentation >= 0 && op.decorate;
+   deco_prefix prefix;
+   for (auto i = 0; i < tsvtree::ssize(roots); ++i) {
+      tree_tsv_traversal iter {roots[i], std::numeric_limits<int>::max()};
+      for (; !iter.done(); iter.next()) {
+         auto const d = iter.depth();
+         std::string_view deco;
+         if (decorate) {
+            auto const last = d == 0 ? i + 1 == tsvtree::ssize(roots) : iter.lasts()[d - 1];
+            deco = prefix.next(d + shift, last);
+         }
+
+         write_tree_line(os,
+                         iter.line().back()->name,
+                         d + shift,
+                         op.indentation,
+                         op.out_field_sep,
+                         deco,
+                         op.decorate);
+         os << op.out_line_break;
+      }
+   }
+}
+
+void
+follow_tree(std::string const& file,
+            tsv_cfg const& op,
+            output_sink& os)
+{
+   line_reader reader {file};
+   auto t = std::make_unique<tree>();
+   auto initial = true;
+
+   // The rows present at the start are built at once, inserting them
+   // one by one costs the size of the children arrays for each row.
+   std::string content;
+
+   for (;;) {
+      std::string_view line;
+      while (reader.next_available(line, '\n')) {
+         if (initial) {
+            (content += line) += '\n';
+            continue;
+         }
+
+         auto const row = split_line(line, op.in_field_sep);
+         if (std::empty(row))
+            continue;
+
+         auto const depth = t->insert(row);
+
+         for (auto d = depth; d < tsvtree::ssize(row); ++d) {
+            os << '+';
+            for (auto i = 0; i <= d; ++i)
+               os << op.out_field_sep << row[i];
+            os << op.out_line_break;
+         }
+      }
+
+      if (initial) {
+         auto table = parse_tsv(content, op.in_field_sep, op.threads);
+         t->build(std::move(table.rows), op.threads);
+         content = std::string {};
+         write_full_tree(*t, op, os);
+         initial = false;
+      }
+
+      os.flush();
+      if (!reader.wait())
+         return;
+
+      // The tree of a truncated file is written again from scratch.
+      if (reader.rewind_if_truncated()) {
+         t = std::make_unique<tree>();
+         initial = true;
+      }
+   }
+}
+
+} // tsvtree
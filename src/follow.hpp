@@ -0,0 +1,41 @@
+/* Copyright (c) 2020 - 2021 Marcelo Zimbres Silva (mzimbres at gmail dot com)
+ *
+ * This file is part of tsvtree.
+ *
+ * tsvtree is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tsvtree is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tsvtree.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <string>
+
+#include "tsv.hpp"
+
+namespace tsvtree
+{
+
+class output_sink;
+
+// Keeps the tree of a tsv file in memory while rows are appended to
+// it, like tail -f. The tree of the rows present at the start is
+// written in full. Afterwards, each node added by a new row is written
+// as a line with a + followed by its path, so that the cost of an
+// update depends only on the new rows. Runs until the end of a pipe,
+// files are followed forever and read again if they are truncated.
+void
+follow_tree(std::string const& file,
+            tsv_cfg const& op,
+            output_sink& os);
+
+} // tsvtree
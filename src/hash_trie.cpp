@@ -0,0 +1,131 @@
+/* Copyright (c) 2020 - 2021 Marcelo Zimbres Silva (mzimbres at gmail dot com)
+ *
+ * This file is part of tsvtree.
+ *
+ * tsvtree is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tsvtree is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tsvtree.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include "hash_trie.hpp"
+
+#include <algorithm>
+#include <functional>
+
+namespace tsvtree
+{
+
+std::uint64_t node_hash(int parent, std::string_view name) noexcept
+{
+   auto const h = std::hash<std::string_view> {}(name);
+   return h ^ (static_cast<std::uint64_t>(parent) * 0x9e3779b97f4a7c15);
+}
+
+hash_trie::hash_trie(std::size_t size_hint)
+: nodes_ {{{}, -1}}
+{
+   // Twice the expected number of nodes keeps the load factor below
+   // one half without growing.
+   std::size_t n = 1 << 10;
+   while (n < 2 * size_hint)
+      n *= 2;
+
+   nodes_.reserve(size_hint + 1);
+   table_.assign(n, {0, -1});
+   mask_ = n - 1;
+}
+
+void hash_trie::grow()
+{
+   std::vector<entry> table(2 * std::size(table_), {0, -1});
+   mask_ = std::size(table) - 1;
+   for (auto const& e : table_) {
+      if (e.id == -1)
+         continue;
+
+      auto i = e.tag & mask_;
+      while (table[i].id != -1)
+         i = (i + 1) & mask_;
+      table[i] = e;
+   }
+
+   table_ = std::move(table);
+}
+
+int
+hash_trie::insert(array_view<std::string_view const> row,
+                  std::vector<int>* path)
+{
+   if (path)
+      path->clear();
+
+   auto added = 0;
+   auto parent = head;
+   for (auto const& name : row) {
+      if (2 * std::size(nodes_) >= std::size(table_))
+         grow();
+
+      auto const tag = static_cast<std::uint32_t>(node_hash(parent, name) >> 32);
+      std::size_t i = tag & mask_;
+      for (; table_[i].id != -1; i = (i + 1) & mask_) {
+         auto const& e = table_[i];
+         if (e.tag == tag && nodes_[e.id].parent == parent && nodes_[e.id].name == name)
+            break;
+      }
+
+      if (table_[i].id == -1) {
+         table_[i] = {tag, tsvtree::ssize(nodes_)};
+         nodes_.push_back({name, parent});
+         ++added;
+      }
+
+      parent = table_[i].id;
+      if (path)
+         path->push_back(parent);
+   }
+
+   return added;
+}
+
+void hash_trie::finish(bool sort)
+{
+   table_ = {};
+
+   // Counting sort of the nodes by parent, the ids are in the order
+   // the nodes first appear.
+   auto const n = tsvtree::ssize(nodes_);
+   begin_.assign(n + 1, 0);
+   for (auto i = 1; i < n; ++i)
+      ++begin_[nodes_[i].parent + 1];
+
+   for (auto i = 0; i < n; ++i)
+      begin_[i + 1] += begin_[i];
+
+   children_.resize(n - 1);
+   std::vector<int> next(std::begin(begin_), std::end(begin_) - 1);
+   for (auto i = 1; i < n; ++i)
+      children_[next[nodes_[i].parent]++] = i;
+
+   if (!sort)
+      return;
+
+   for (auto i = 0; i < n; ++i) {
+      auto const first = std::begin(children_) + begin_[i];
+      auto const last = std::begin(children_) + begin_[i + 1];
+      if (last - first > 1)
+         std::sort(first, last, [&](auto a, auto b)
+            { return nodes_[a].name < nodes_[b].name; });
+   }
+}
+
+} // tsvtree
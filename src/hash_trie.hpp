@@ -0,0 +1,91 @@
+/* Copyright (c) 2020 - 2021 Marcelo Zimbres Silva (mzimbres at gmail dot com)
+ *
+ * This file is part of tsvtree.
+ *
+ * tsvtree is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tsvtree is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tsvtree.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <string_view>
+
+#include "utils.hpp"
+
+namespace tsvtree
+{
+
+// Tree of tsv rows built by inserting one row at a time, without
+// sorting them. The child of a node with a given name is looked up in
+// a hash table keyed by the parent and the name, so that building
+// takes expected time proportional to the number of fields. Only the
+// parent of each node is recorded while inserting, the children are
+// laid out in one array by finish, in the order they first appear or
+// sorted. The names are views into the rows.
+class hash_trie {
+public:
+   // The node that is the parent of the nodes on depth 0.
+   static constexpr int head = 0;
+
+private:
+   struct node {
+      std::string_view name;
+      int parent;
+   };
+
+   // Open addressing with linear probing. The tag has 32 bits of the
+   // hash, its low bits are the position in the table. The entries
+   // that differ are then mostly told apart and moved when the table
+   // grows without reading the node. Empty entries have id -1.
+   struct entry {
+      std::uint32_t tag;
+      int id;
+   };
+
+   std::vector<node> nodes_;
+   std::vector<entry> table_;
+   std::size_t mask_ = 0;
+
+   // The children of node i are children_[begin_[i], begin_[i + 1]).
+   std::vector<int> begin_;
+   std::vector<int> children_;
+
+   void grow();
+
+public:
+   // The number of nodes expected, e.g. the number of fields.
+   explicit hash_trie(std::size_t size_hint = 0);
+
+   // Inserts the nodes of the row that are not in the trie yet. When
+   // given, the ids of the nodes on its path are written to path.
+   // Returns the number of new nodes.
+   int insert(array_view<std::string_view const> row,
+              std::vector<int>* path = nullptr);
+
+   // Lays out the children of the nodes, to be called after the last
+   // insertion. They are sorted by name if sort is set.
+   void finish(bool sort);
+
+   auto name(int i) const noexcept { return nodes_[i].name; }
+
+   array_view<int const> children(int i) const noexcept
+      { return {children_.data() + begin_[i], begin_[i + 1] - begin_[i]}; }
+
+   // The number of nodes, without the head.
+   auto size() const noexcept { return tsvtree::ssize(nodes_) - 1; }
+};
+
+} // tsvtree
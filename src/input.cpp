@@ -0,0 +1,324 @@
+/* Copyright (c) 2020 - 2021 Marcelo Zimbres Silva (mzimbres at gmail dot com)
+ *
+ * This file is part of tsvtree.
+ *
+ * tsvtree is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tsvtree is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tsvtree.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "input.hpp"
+#include "stats.hpp"
+
+#include <cerrno>
+#include <algorithm>
+#include <thread>
+#include <chrono>
+#include <cstring>
+#include <exception>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace tsvtree
+{
+
+void input_buffer::read_all(int fd)
+{
+   constexpr std::size_t chunk = 1 << 20;
+
+   auto size = std::size(buffer_);
+   for (;;) {
+      buffer_.resize(size + chunk);
+      auto const n = ::read(fd, buffer_.data() + size, chunk);
+      if (n == 0)
+         break;
+
+      if (n < 0) {
+         if (errno == EINTR)
+            continue;
+
+         throw std::runtime_error(std::string {"Read error: "} + std::strerror(errno));
+      }
+
+      size += n;
+   }
+
+   buffer_.resize(size);
+   data_ = buffer_.data();
+   size_ = size;
+}
+
+input_buffer::input_buffer(std::string const& file)
+{
+   phase_timer phase {"read"};
+   open(file);
+   phase.add(size_);
+}
+
+void input_buffer::open(std::string const& file)
+{
+   if (std::empty(file)) {
+      read_all(STDIN_FILENO);
+      return;
+   }
+
+   auto const fd = ::open(file.c_str(), O_RDONLY);
+   if (fd == -1)
+      throw std::runtime_error("Unable to open " + file + ": " + std::strerror(errno));
+
+   struct stat st;
+   if (::fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+      auto* p = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (p != MAP_FAILED) {
+         ::madvise(p, st.st_size, MADV_SEQUENTIAL);
+         data_ = static_cast<char const*>(p);
+         size_ = st.st_size;
+         mapped_ = true;
+         ::close(fd);
+         return;
+      }
+   }
+
+   // Not mappable (fifo, empty file, etc.), falls back to reading.
+   try {
+      read_all(fd);
+   } catch (...) {
+      ::close(fd);
+      throw;
+   }
+
+   ::close(fd);
+}
+
+void input_buffer::advise_random() const noexcept
+{
+   if (mapped_)
+      ::madvise(const_cast<char*>(data_), size_, MADV_RANDOM);
+}
+
+input_buffer::~input_buffer()
+{
+   if (mapped_)
+      ::munmap(const_cast<char*>(data_), size_);
+}
+
+//-------------------------------------------------------------------
+line_reader::line_reader(std::string const& file)
+: buffer_(1 << 16, '\0')
+{
+   fd_ = std::empty(file) ? STDIN_FILENO : ::open(file.c_str(), O_RDONLY);
+   if (fd_ == -1)
+      throw std::runtime_error("Unable to open " + file + ": " + std::strerror(errno));
+
+   struct stat st;
+   regular_ = ::fstat(fd_, &st) == 0 && S_ISREG(st.st_mode);
+}
+
+line_reader::~line_reader()
+{
+   if (fd_ != STDIN_FILENO)
+      ::close(fd_);
+}
+
+// Moves the incomplete line to the front and grows the buffer if the
+// line does not fit in it.
+void line_reader::compact()
+{
+   // The size of the buffer is its capacity, it must not shrink.
+   std::copy(std::begin(buffer_) + begin_, std::begin(buffer_) + end_, std::begin(buffer_));
+   end_ -= begin_;
+   begin_ = 0;
+   if (end_ == std::size(buffer_))
+      buffer_.resize(2 * std::size(buffer_));
+}
+
+// Returns false when nothing could be read, which is the end of the
+// input for anything but a growing file.
+bool line_reader::read_some()
+{
+   for (;;) {
+      auto const n = ::read(fd_, buffer_.data() + end_, std::size(buffer_) - end_);
+      if (n > 0) {
+         end_ += n;
+         offset_ += n;
+         return true;
+      }
+
+      if (n == 0)
+         return false;
+
+      if (errno != EINTR)
+         throw std::runtime_error(std::string {"Read error: "} + std::strerror(errno));
+   }
+}
+
+bool line_reader::fill()
+{
+   if (eof_)
+      return false;
+
+   compact();
+   if (read_some())
+      return true;
+
+   eof_ = true;
+   return false;
+}
+
+bool line_reader::fill_available()
+{
+   if (eof_)
+      return false;
+
+   compact();
+   if (!regular_) {
+      pollfd p {fd_, POLLIN, 0};
+      if (::poll(&p, 1, 0) <= 0)
+         return false;
+   }
+
+   if (read_some())
+      return true;
+
+   // Files may still grow, pipes are done.
+   eof_ = !regular_;
+   return false;
+}
+
+bool line_reader::next(std::string_view& line, char line_break)
+{
+   std::size_t searched = begin_;
+   for (;;) {
+      std::string_view const data {buffer_.data() + searched, end_ - searched};
+      auto const p = data.find(line_break);
+      if (p != std::string_view::npos) {
+         line = {buffer_.data() + begin_, searched + p - begin_};
+         begin_ = searched + p + 1;
+         return true;
+      }
+
+      searched = end_ - begin_;
+      if (!fill()) {
+         if (begin_ == end_)
+            return false;
+
+         // Last line without line break.
+         line = {buffer_.data() + begin_, end_ - begin_};
+         begin_ = end_;
+         return true;
+      }
+   }
+}
+
+bool line_reader::next_available(std::string_view& line, char line_break)
+{
+   std::size_t searched = begin_;
+   for (;;) {
+      std::string_view const data {buffer_.data() + searched, end_ - searched};
+      auto const p = data.find(line_break);
+      if (p != std::string_view::npos) {
+         line = {buffer_.data() + begin_, searched + p - begin_};
+         begin_ = searched + p + 1;
+         return true;
+      }
+
+      searched = end_ - begin_;
+      if (fill_available())
+         continue;
+
+      if (!eof_ || begin_ == end_)
+         return false;
+
+      // Last line of a pipe without line break.
+      line = {buffer_.data() + begin_, end_ - begin_};
+      begin_ = end_;
+      return true;
+   }
+}
+
+bool line_reader::wait() const
+{
+   if (eof_)
+      return false;
+
+   if (regular_) {
+      std::this_thread::sleep_for(std::chrono::milliseconds {100});
+      return true;
+   }
+
+   pollfd p {fd_, POLLIN, 0};
+   while (::poll(&p, 1, -1) == -1 && errno == EINTR)
+      ;
+
+   return true;
+}
+
+bool line_reader::rewind_if_truncated()
+{
+   struct stat st;
+   if (!regular_ || ::fstat(fd_, &st) != 0 || static_cast<std::size_t>(st.st_size) >= offset_)
+      return false;
+
+   if (::lseek(fd_, 0, SEEK_SET) == -1)
+      throw std::runtime_error(std::string {"Seek error: "} + std::strerror(errno));
+
+   begin_ = 0;
+   end_ = 0;
+   offset_ = 0;
+   return true;
+}
+
+bool line_reader::last_line(std::string& line, char line_break) const
+{
+   struct stat st;
+   if (::fstat(fd_, &st) != 0 || !S_ISREG(st.st_mode))
+      return false;
+
+   line.clear();
+
+   // Reads backwards in chunks until a complete non-empty line is
+   // found.
+   constexpr off_t chunk = 4096;
+   std::string tail;
+   auto end = st.st_size;
+   while (end > 0) {
+      auto const begin = end > chunk ? end - chunk : 0;
+      std::string buf(end - begin, '\0');
+      auto const n = ::pread(fd_, buf.data(), std::size(buf), begin);
+      if (n != static_cast<ssize_t>(std::size(buf)))
+         return false;
+
+      tail.insert(0, buf);
+      end = begin;
+
+      auto const last = tail.find_last_not_of(line_break);
+      if (last == std::string::npos)
+         continue;
+
+      auto const first = tail.find_last_of(line_break, last);
+      if (first == std::string::npos && end != 0)
+         continue;
+
+      auto const from = first == std::string::npos ? 0 : first + 1;
+      line = tail.substr(from, last + 1 - from);
+      return true;
+   }
+
+   return true;
+}
+
+} // tsvtree
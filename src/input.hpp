@@ -0,0 +1,108 @@
+/* Copyright (c) 2020 - 2021 Marcelo Zimbres Silva (mzimbres at gmail dot com)
+ *
+ * This file is part of tsvtree.
+ *
+ * tsvtree is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tsvtree is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tsvtree.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <string>
+#include <string_view>
+
+namespace tsvtree
+{
+
+// The content of an input file. Regular files are mapped into memory
+// so that the parsers can refer to the data without copying it, for
+// anything else (stdin, pipes) the content is read into a buffer.
+// An empty file name means stdin.
+class input_buffer {
+private:
+   char const* data_ = nullptr;
+   std::size_t size_ = 0;
+   bool mapped_ = false;
+   std::string buffer_;
+
+   void read_all(int fd);
+   void open(std::string const& file);
+
+public:
+   input_buffer(input_buffer const&) = delete;
+   input_buffer& operator=(input_buffer const&) = delete;
+   input_buffer(input_buffer&&) = delete;
+   input_buffer& operator=(input_buffer&&) = delete;
+   explicit input_buffer(std::string const& file);
+   ~input_buffer();
+
+   auto view() const noexcept { return std::string_view {data_, size_}; }
+   auto mapped() const noexcept { return mapped_; }
+
+   // Tells the kernel that the data is not read sequentially, so that
+   // only the pages that are used are loaded.
+   void advise_random() const noexcept;
+};
+
+// Reads a file (or stdin) line by line keeping only a small buffer in
+// memory. Used by the streaming modes that must not hold the whole
+// input.
+class line_reader {
+private:
+   int fd_ = -1;
+   bool eof_ = false;
+   bool regular_ = false;
+   std::string buffer_;
+   std::size_t begin_ = 0;
+   std::size_t end_ = 0;
+   std::size_t offset_ = 0;
+
+   void compact();
+   bool read_some();
+   bool fill();
+   bool fill_available();
+
+public:
+   line_reader(line_reader const&) = delete;
+   line_reader& operator=(line_reader const&) = delete;
+   line_reader(line_reader&&) = delete;
+   line_reader& operator=(line_reader&&) = delete;
+   explicit line_reader(std::string const& file);
+   ~line_reader();
+
+   // Reads the next line into line. The view is valid until the next
+   // call. Returns false when there are no more lines.
+   bool next(std::string_view& line, char line_break);
+
+   // Returns the last non-empty line of the file without reading the
+   // rest of it. Returns false if the input is not seekable
+   // e.g. stdin or a pipe.
+   bool last_line(std::string& line, char line_break) const;
+
+   // Used by --follow. Like next but returns only complete lines that
+   // can be read without blocking, the incomplete one is kept for the
+   // next call. At the end of a pipe its last line is returned even
+   // without line break.
+   bool next_available(std::string_view& line, char line_break);
+
+   // Blocks until there may be more to read. Returns false at the end
+   // of a pipe. Regular files never end since they can grow, they are
+   // polled.
+   bool wait() const;
+
+   // Starts reading from the beginning if the file is now smaller than
+   // what has been read e.g. a rotated log. Returns whether it did.
+   bool rewind_if_truncated();
+};
+
+} // tsvtree
@@ -0,0 +1,94 @@
+/* Copyright (c) 2020 - 2021 Marcelo Zimbres Silva (mzimbres at gmail dot com)
+ *
+ * This file is part of tsvtree.
+ *
+ * tsvtree is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tsvtree is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tsvtree.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "output.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <unistd.h>
+
+namespace tsvtree
+{
+
+output_sink::output_sink(std::size_t capacity)
+: buffer_ {new char[capacity]}
+, capacity_ {capacity}
+{ }
+
+void output_sink::flush()
+{
+   // The buffer is emptied first so that a failed write is not
+   // repeated by the destructor.
+   auto const n = size_;
+   size_ = 0;
+   written_ += n;
+   write_all(buffer_.get(), n);
+}
+
+//-------------------------------------------------------------------
+fd_sink::fd_sink(int fd, std::size_t capacity)
+: output_sink {capacity}
+, fd_ {fd}
+{ }
+
+fd_sink::~fd_sink()
+{
+   try {
+      flush();
+   } catch (...) {
+   }
+}
+
+void fd_sink::write_all(char const* data, std::size_t n)
+{
+   while (n != 0) {
+      auto const r = ::write(fd_, data, n);
+      if (r < 0) {
+         if (errno == EINTR)
+            continue;
+
+         throw std::runtime_error(std::string {"Write error: "} + std::strerror(errno));
+      }
+
+      data += r;
+      n -= r;
+   }
+}
+
+//-------------------------------------------------------------------
+string_sink::string_sink(std::string& str)
+: output_sink {1 << 16}
+, str_ {&str}
+{ }
+
+string_sink::~string_sink()
+{
+   try {
+      flush();
+   } catch (...) {
+   }
+}
+
+void string_sink::write_all(char const* data, std::size_t n)
+{
+   str_->append(data, n);
+}
+
+} // tsvtree
@@ -0,0 +1,143 @@
+/* Copyright (c) 2020 - 2021 Marcelo Zimbres Silva (mzimbres at gmail dot com)
+ *
+ * This file is part of tsvtree.
+ *
+ * tsvtree is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tsvtree is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tsvtree.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <charconv>
+#include <string_view>
+#include <type_traits>
+
+namespace tsvtree
+{
+
+// Destination of the output. The data is collected in a large buffer
+// that is passed to the destination only when it is full and on
+// flush, instead of on every line, so that the renderers can write
+// node by node.
+class output_sink {
+private:
+   std::unique_ptr<char[]> buffer_;
+   std::size_t capacity_;
+   std::size_t size_ = 0;
+   std::size_t written_ = 0;
+
+protected:
+   // Writes the data to the destination.
+   virtual void write_all(char const* data, std::size_t n) = 0;
+
+public:
+   static constexpr std::size_t default_capacity = 1 << 20;
+
+   output_sink(output_sink const&) = delete;
+   output_sink& operator=(output_sink const&) = delete;
+   output_sink(output_sink&&) = delete;
+   output_sink& operator=(output_sink&&) = delete;
+
+   explicit output_sink(std::size_t capacity = default_capacity);
+   virtual ~output_sink() = default;
+
+   void write(char const* data, std::size_t n)
+   {
+      if (n <= capacity_ - size_) {
+         std::char_traits<char>::copy(buffer_.get() + size_, data, n);
+         size_ += n;
+         return;
+      }
+
+      flush();
+      if (n >= capacity_) {
+         written_ += n;
+         write_all(data, n);
+         return;
+      }
+
+      std::char_traits<char>::copy(buffer_.get(), data, n);
+      size_ = n;
+   }
+
+   void flush();
+
+   // Number of bytes written so far, including the buffered ones.
+   auto bytes() const noexcept { return written_ + size_; }
+
+   output_sink& operator<<(std::string_view s)
+   {
+      write(s.data(), std::size(s));
+      return *this;
+   }
+
+   output_sink& operator<<(char c)
+   {
+      if (size_ == capacity_)
+         flush();
+
+      buffer_[size_++] = c;
+      return *this;
+   }
+
+   template <class T, class = std::enable_if_t<std::is_integral_v<T>>>
+   output_sink& operator<<(T n)
+   {
+      char buf[24];
+      auto const r = std::to_chars(buf, buf + sizeof buf, n);
+      write(buf, r.ptr - buf);
+      return *this;
+   }
+
+   // The shortest representation that reads back the same value.
+   output_sink& operator<<(double d)
+   {
+      char buf[32];
+      auto const r = std::to_chars(buf, buf + sizeof buf, d);
+      write(buf, r.ptr - buf);
+      return *this;
+   }
+};
+
+// Writes to a file descriptor with write(2), normally stdout.
+class fd_sink : public output_sink {
+private:
+   int fd_;
+
+protected:
+   void write_all(char const* data, std::size_t n) override;
+
+public:
+   explicit fd_sink(int fd, std::size_t capacity = default_capacity);
+
+   // Writes what is left in the buffer, errors are ignored. Call flush
+   // to see them.
+   ~fd_sink();
+};
+
+// Appends to a string, for output that is processed further.
+class string_sink : public output_sink {
+private:
+   std::string* str_;
+
+protected:
+   void write_all(char const* data, std::size_t n) override;
+
+public:
+   explicit string_sink(std::string& str);
+   ~string_sink();
+};
+
+} // tsvtree
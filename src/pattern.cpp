@@ -0,0 +1,215 @@
+/* Copyright (c) 2020 - 2021 Marcelo Zimbres Silva (mzimbres at gmail dot com)
+ *
+ * This file is part of tsvtree.
+ *
+ * tsvtree is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tsvtree is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tsvtree.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include "pattern.hpp"
+
+#include <stdexcept>
+
+namespace tsvtree
+{
+
+// Matches a [...] class at the front of glob and advances glob past
+// it. ok is false if the class is not closed, [ is then an ordinary
+// character.
+bool class_match(std::string_view& glob, unsigned char c, bool& ok) noexcept
+{
+   std::size_t i = 1;
+   auto const negate = i < std::size(glob) && (glob[i] == '!' || glob[i] == '^');
+   if (negate)
+      ++i;
+
+   // A ] right after the [ is part of the class.
+   auto found = false;
+   for (auto first = true; i < std::size(glob) && (glob[i] != ']' || first); first = false) {
+      unsigned char lo = glob[i++];
+      if (lo == '\\' && i < std::size(glob))
+         lo = glob[i++];
+
+      auto hi = lo;
+      if (i + 1 < std::size(glob) && glob[i] == '-' && glob[i + 1] != ']') {
+         hi = glob[i + 1];
+         i += 2;
+      }
+
+      if (lo <= c && c <= hi)
+         found = true;
+   }
+
+   ok = i < std::size(glob);
+   if (ok)
+      glob.remove_prefix(i + 1);
+
+   return found != negate;
+}
+
+// Matches c against the element at the front of glob, that is not a *,
+// and advances glob past it.
+bool match_one(std::string_view& glob, char c) noexcept
+{
+   if (glob.front() == '?') {
+      glob.remove_prefix(1);
+      return true;
+   }
+
+   if (glob.front() == '[') {
+      auto ok = false;
+      auto const ret = class_match(glob, c, ok);
+      if (ok)
+         return ret;
+   }
+
+   if (glob.front() == '\\' && std::size(glob) > 1)
+      glob.remove_prefix(1);
+
+   auto const ret = glob.front() == c;
+   glob.remove_prefix(1);
+   return ret;
+}
+
+bool glob_match(std::string_view glob, std::string_view name) noexcept
+{
+   // Where to resume when the rest fails after the last *, which then
+   // matches one more character.
+   std::string_view star_glob;
+   std::string_view star_name;
+   auto star = false;
+
+   while (!std::empty(name)) {
+      if (!std::empty(glob) && glob.front() == '*') {
+         glob.remove_prefix(1);
+         star_glob = glob;
+         star_name = name;
+         star = true;
+         continue;
+      }
+
+      if (!std::empty(glob) && match_one(glob, name.front())) {
+         name.remove_prefix(1);
+         continue;
+      }
+
+      if (!star)
+         return false;
+
+      star_name.remove_prefix(1);
+      glob = star_glob;
+      name = star_name;
+   }
+
+   return glob.find_first_not_of('*') == std::string_view::npos;
+}
+
+// Splits a pattern at the slashes that are not escaped, the escapes
+// of slashes are removed.
+std::vector<std::string> split_levels(std::string_view pattern)
+{
+   std::vector<std::string> ret(1);
+   for (std::size_t i = 0; i < std::size(pattern); ++i) {
+      auto const c = pattern[i];
+      if (c == '\\' && i + 1 < std::size(pattern)) {
+         if (pattern[i + 1] != '/')
+            ret.back() += c;
+         ret.back() += pattern[++i];
+      } else if (c == '/') {
+         ret.emplace_back();
+      } else {
+         ret.back() += c;
+      }
+   }
+
+   return ret;
+}
+
+path_pattern::path_pattern(std::vector<std::string> const& patterns)
+{
+   // The bit of the next position, each position is a bit of the state.
+   auto const next_bit = [&] {
+      if (std::size(positions_) >= 8 * sizeof (state_type))
+         throw std::runtime_error("Too many levels in the path patterns.");
+      return state_type {1} << std::size(positions_);
+   };
+
+   state_type start = 0;
+   for (auto const& p : patterns) {
+      start |= next_bit();
+      for (auto& level : split_levels(p)) {
+         auto const k = level == "**" ? kind::any : kind::glob;
+         positions_.push_back({k, std::move(level)});
+      }
+
+      accept_ |= next_bit();
+      positions_.push_back({kind::accept, {}});
+   }
+
+   start_ = closure(start);
+}
+
+// Adds the positions after each ** reached, since it may also match no
+// level at all. Positions are visited in increasing order so that
+// consecutive ones are followed too.
+auto path_pattern::closure(state_type s) const noexcept -> state_type
+{
+   for (auto i = 0; i < tsvtree::ssize(positions_); ++i)
+      if ((s >> i & 1) && positions_[i].k == kind::any)
+         s |= state_type {1} << (i + 1);
+
+   return s;
+}
+
+auto
+path_pattern::next(state_type s, std::string_view name) const -> state_type
+{
+   state_type ret = 0;
+   for (; s != 0; s &= s - 1) {
+      auto const i = __builtin_ctzll(s);
+      auto const& p = positions_[i];
+      if (p.k == kind::any)
+         ret |= state_type {1} << i;
+      else if (p.k == kind::glob && glob_match(p.glob, name))
+         ret |= state_type {1} << (i + 1);
+   }
+
+   return closure(ret);
+}
+
+path_filter::path_filter(std::vector<std::string> const& match,
+                         std::vector<std::string> const& exclude)
+: match_ {match}
+, exclude_ {exclude}
+{ }
+
+int path_filter::keep(array_view<std::string_view const> row,
+                      bool root,
+                      bool* excluded) const
+{
+   auto ret = 0;
+   auto s = root ? next(start(), "Root") : start();
+   for (auto d = 0; d < tsvtree::ssize(row) && !pruned(s); ++d) {
+      s = next(s, row[d]);
+      if (!pruned(s) && selected(s))
+         ret = d + 1;
+   }
+
+   if (excluded && pruned(s))
+      *excluded = exclude_.matches(s.exclude);
+
+   return ret;
+}
+
+} // tsvtree
@@ -0,0 +1,123 @@
+/* Copyright (c) 2020 - 2021 Marcelo Zimbres Silva (mzimbres at gmail dot com)
+ *
+ * This file is part of tsvtree.
+ *
+ * tsvtree is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tsvtree is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tsvtree.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <string_view>
+
+#include "utils.hpp"
+
+namespace tsvtree
+{
+
+// Whether the name matches a glob with *, ? and [...] classes ([!...]
+// negates). A backslash makes the next character literal.
+bool glob_match(std::string_view glob, std::string_view name) noexcept;
+
+// A set of path patterns, e.g. Earth/*/Western Europe/**, where each
+// level is a glob matched against the node at that depth and ** matches
+// any number of levels. Escape a / in a name with a backslash. The
+// patterns are run together as an automaton whose state is the set of
+// positions reached by the path so far, so that the state of a node is
+// computed from the one of its parent.
+class path_pattern {
+public:
+   using state_type = std::uint64_t;
+
+private:
+   enum class kind {glob, any, accept};
+
+   struct position {
+      kind k;
+      std::string glob;
+   };
+
+   std::vector<position> positions_;
+   state_type start_ = 0;
+   state_type accept_ = 0;
+
+   state_type closure(state_type s) const noexcept;
+
+public:
+   path_pattern() = default;
+   explicit path_pattern(std::vector<std::string> const& patterns);
+
+   auto empty() const noexcept { return std::empty(positions_); }
+
+   // The state of the empty path.
+   auto start() const noexcept { return start_; }
+
+   // The state after adding a node with the given name to the path.
+   state_type next(state_type s, std::string_view name) const;
+
+   // Whether a path in this state matches one of the patterns.
+   auto matches(state_type s) const noexcept { return (s & accept_) != 0; }
+};
+
+// Selects the nodes that match one of the --match patterns, or every
+// node if there is none, and are not in the subtree of a node that
+// matches one of the --exclude patterns. Nodes that are not selected
+// are still kept when they are an ancestor of one that is.
+class path_filter {
+private:
+   path_pattern match_;
+   path_pattern exclude_;
+
+public:
+   struct state {
+      path_pattern::state_type match;
+      path_pattern::state_type exclude;
+   };
+
+   path_filter() = default;
+   path_filter(std::vector<std::string> const& match,
+               std::vector<std::string> const& exclude);
+
+   auto empty() const noexcept { return match_.empty() && exclude_.empty(); }
+
+   auto start() const noexcept
+      { return state {match_.start(), exclude_.start()}; }
+
+   state next(state s, std::string_view name) const
+      { return {match_.next(s.match, name), exclude_.next(s.exclude, name)}; }
+
+   // Whether neither the node nor its subtree can be selected.
+   auto pruned(state s) const noexcept
+   {
+      return (!match_.empty() && s.match == 0) || exclude_.matches(s.exclude);
+   }
+
+   // Whether the node is selected, it must not be pruned.
+   auto selected(state s) const noexcept
+      { return match_.empty() || match_.matches(s.match); }
+
+   // The number of fields of a tsv row that are kept, that is, up to
+   // its last selected node. Zero if there is none. With root the path
+   // of the row begins with the Root node added above the rows, as in
+   // the output. excluded tells whether the row was cut by one of the
+   // exclude patterns.
+   int keep(array_view<std::string_view const> row,
+            bool root,
+            bool* excluded = nullptr) const;
+};
+
+} // tsvtree
@@ -0,0 +1,126 @@
+/* Copyright (c) 2020 - 2021 Marcelo Zimbres Silva (mzimbres at gmail dot com)
+ *
+ * This file is part of tsvtree.
+ *
+ * tsvtree is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tsvtree is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tsvtree.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "scan.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#  define TSVTREE_X86 1
+#  include <immintrin.h>
+#endif
+
+namespace tsvtree
+{
+
+using block_mask_fn = std::uint64_t (*)(char const*, char, char);
+
+std::uint64_t
+scalar_mask(char const* p, std::size_t n, char a, char b) noexcept
+{
+   std::uint64_t ret = 0;
+   for (std::size_t i = 0; i < n; ++i)
+      if (p[i] == a || p[i] == b)
+         ret |= std::uint64_t {1} << i;
+
+   return ret;
+}
+
+std::uint64_t scalar_block_mask(char const* p, char a, char b)
+{
+   return scalar_mask(p, delim_scanner::block_size, a, b);
+}
+
+#ifdef TSVTREE_X86
+std::uint64_t sse2_block_mask(char const* p, char a, char b)
+{
+   auto const va = _mm_set1_epi8(a);
+   auto const vb = _mm_set1_epi8(b);
+
+   std::uint64_t ret = 0;
+   for (auto i = 0; i < 4; ++i) {
+      auto const v = _mm_loadu_si128(reinterpret_cast<__m128i const*>(p + 16 * i));
+      auto const eq = _mm_or_si128(_mm_cmpeq_epi8(v, va), _mm_cmpeq_epi8(v, vb));
+      std::uint64_t const m = static_cast<std::uint16_t>(_mm_movemask_epi8(eq));
+      ret |= m << (16 * i);
+   }
+
+   return ret;
+}
+
+__attribute__((target("avx2")))
+std::uint64_t avx2_block_mask(char const* p, char a, char b)
+{
+   auto const va = _mm256_set1_epi8(a);
+   auto const vb = _mm256_set1_epi8(b);
+
+   auto const v0 = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(p));
+   auto const v1 = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(p + 32));
+
+   auto const e0 = _mm256_or_si256(_mm256_cmpeq_epi8(v0, va), _mm256_cmpeq_epi8(v0, vb));
+   auto const e1 = _mm256_or_si256(_mm256_cmpeq_epi8(v1, va), _mm256_cmpeq_epi8(v1, vb));
+
+   std::uint64_t const lo = static_cast<std::uint32_t>(_mm256_movemask_epi8(e0));
+   std::uint64_t const hi = static_cast<std::uint32_t>(_mm256_movemask_epi8(e1));
+   return lo | (hi << 32);
+}
+#endif
+
+struct scanner_impl_type {
+   block_mask_fn fn;
+   char const* name;
+};
+
+scanner_impl_type select_impl() noexcept
+{
+#ifdef TSVTREE_X86
+   __builtin_cpu_init();
+   if (__builtin_cpu_supports("avx2"))
+      return {avx2_block_mask, "avx2"};
+
+   if (__builtin_cpu_supports("sse2"))
+      return {sse2_block_mask, "sse2"};
+#endif
+
+   return {scalar_block_mask, "scalar"};
+}
+
+scanner_impl_type const impl = select_impl();
+
+char const* scanner_impl() noexcept
+{
+   return impl.name;
+}
+
+delim_scanner::delim_scanner(std::string_view data, char a, char b)
+: data_ {data.data()}
+, size_ {std::size(data)}
+, a_ {a}
+, b_ {b}
+{
+   if (size_ != 0)
+      mask_ = load(0);
+}
+
+std::uint64_t delim_scanner::load(std::size_t offset) const noexcept
+{
+   if (offset + block_size <= size_)
+      return impl.fn(data_ + offset, a_, b_);
+
+   return scalar_mask(data_ + offset, size_ - offset, a_, b_);
+}
+
+} // tsvtree
@@ -0,0 +1,71 @@
+/* Copyright (c) 2020 - 2021 Marcelo Zimbres Silva (mzimbres at gmail dot com)
+ *
+ * This file is part of tsvtree.
+ *
+ * tsvtree is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tsvtree is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tsvtree.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+namespace tsvtree
+{
+
+// Finds the positions of two delimiters (normally the field separator
+// and the line break) in a buffer. The buffer is processed in blocks
+// of 64 bytes, each producing a bit mask of the delimiter positions,
+// with SSE2 or AVX2 when the CPU supports it. The implementation is
+// selected at runtime.
+class delim_scanner {
+public:
+   static constexpr std::size_t block_size = 64;
+
+private:
+   char const* data_;
+   std::size_t size_;
+   std::size_t block_ = 0;
+   std::uint64_t mask_ = 0;
+   char a_;
+   char b_;
+
+   std::uint64_t load(std::size_t offset) const noexcept;
+
+public:
+   delim_scanner(std::string_view data, char a, char b);
+
+   // Returns the position of the next delimiter or the size of the
+   // buffer when there are no more.
+   std::size_t next() noexcept
+   {
+      while (mask_ == 0) {
+         block_ += block_size;
+         if (block_ >= size_)
+            return size_;
+
+         mask_ = load(block_);
+      }
+
+      auto const i = __builtin_ctzll(mask_);
+      mask_ &= mask_ - 1;
+      return block_ + i;
+   }
+};
+
+// The name of the implementation selected for this CPU, e.g. avx2.
+char const* scanner_impl() noexcept;
+
+} // tsvtree
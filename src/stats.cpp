@@ -0,0 +1,186 @@
+/* Copyright (c) 2020 - 2021 Marcelo Zimbres Silva (mzimbres at gmail dot com)
+ *
+ * This file is part of tsvtree.
+ *
+ * tsvtree is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tsvtree is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tsvtree.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "stats.hpp"
+#include "scan.hpp"
+
+#include <new>
+#include <atomic>
+#include <cstdlib>
+
+#include <time.h>
+#include <sys/resource.h>
+
+// Allocations are counted by replacing the global operator new, the
+// counter is only touched when stats are enabled. The default operator
+// delete calls free and new[] calls new, they are kept.
+namespace
+{
+bool count_allocations = false;
+std::atomic<std::size_t> allocations {0};
+
+auto cpu_seconds() noexcept
+{
+   timespec ts {};
+   ::clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+   return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+long peak_rss_kb() noexcept
+{
+   rusage ru {};
+   ::getrusage(RUSAGE_SELF, &ru);
+   return ru.ru_maxrss;
+}
+}
+
+void* operator new(std::size_t n)
+{
+   if (count_allocations)
+      allocations.fetch_add(1, std::memory_order_relaxed);
+
+   for (;;) {
+      if (auto* p = std::malloc(n == 0 ? 1 : n))
+         return p;
+
+      auto const handler = std::get_new_handler();
+      if (!handler)
+         throw std::bad_alloc {};
+
+      handler();
+   }
+}
+
+namespace tsvtree
+{
+
+run_stats stats;
+
+void run_stats::enable()
+{
+   enabled_ = true;
+   count_allocations = true;
+}
+
+void run_stats::report(std::ostream& os, bool json) const
+{
+   phase_stats total {"total"};
+   for (auto const& p : phases_) {
+      total.wall += p.wall;
+      total.cpu += p.cpu;
+      total.allocations += p.allocations;
+   }
+
+   total.peak_rss_kb = peak_rss_kb();
+
+   if (json) {
+      auto const write_phase = [&](phase_stats const& p) {
+         os << "{\"name\": \"" << p.name << "\""
+            << ", \"wall_s\": " << p.wall
+            << ", \"cpu_s\": " << p.cpu
+            << ", \"bytes\": " << p.bytes
+            << ", \"rows\": " << p.rows
+            << ", \"allocations\": " << p.allocations
+            << ", \"peak_rss_kb\": " << p.peak_rss_kb
+            << "}";
+      };
+
+      os << "{\"phases\": [";
+      for (auto i = 0; i < tsvtree::ssize(phases_); ++i) {
+         if (i != 0)
+            os << ", ";
+         write_phase(phases_[i]);
+      }
+
+      os << "], \"total\": ";
+      write_phase(total);
+      os << ", \"scanner\": \"" << scanner_impl() << "\"";
+      os << ", \"nodes_per_depth\": [";
+      for (auto i = 0; i < tsvtree::ssize(nodes_per_depth_); ++i)
+         os << (i == 0 ? "" : ", ") << nodes_per_depth_[i];
+      os << "]}" << std::endl;
+      return;
+   }
+
+   os << "phase\twall_s\tcpu_s\tbytes\trows\tallocations\tpeak_rss_kb\n";
+   auto const write_phase = [&](phase_stats const& p) {
+      os << p.name << '\t'
+         << p.wall << '\t'
+         << p.cpu << '\t'
+         << p.bytes << '\t'
+         << p.rows << '\t'
+         << p.allocations << '\t'
+         << p.peak_rss_kb << '\n';
+   };
+
+   for (auto const& p : phases_)
+      write_phase(p);
+
+   write_phase(total);
+
+   os << "\nscanner\t" << scanner_impl() << '\n';
+
+   os << "\ndepth\tnodes\n";
+   for (auto i = 0; i < tsvtree::ssize(nodes_per_depth_); ++i)
+      os << i << '\t' << nodes_per_depth_[i] << '\n';
+
+   os << std::flush;
+}
+
+void count_nodes_per_depth(array_view<int const> depths)
+{
+   if (!stats.enabled())
+      return;
+
+   std::vector<std::size_t> n;
+   for (auto d : depths) {
+      if (d >= tsvtree::ssize(n))
+         n.resize(d + 1);
+      ++n[d];
+   }
+
+   stats.set_nodes_per_depth(std::move(n));
+}
+
+phase_timer::phase_timer(char const* name)
+: active_ {stats.enabled()}
+{
+   if (!active_)
+      return;
+
+   p_.name = name;
+   begin_ = clock_type::now();
+   cpu_begin_ = cpu_seconds();
+   allocations_begin_ = allocations.load(std::memory_order_relaxed);
+}
+
+void phase_timer::stop()
+{
+   if (!active_)
+      return;
+
+   active_ = false;
+   std::chrono::duration<double> const d = clock_type::now() - begin_;
+   p_.wall = d.count();
+   p_.cpu = cpu_seconds() - cpu_begin_;
+   p_.allocations = allocations.load(std::memory_order_relaxed) - allocations_begin_;
+   p_.peak_rss_kb = peak_rss_kb();
+   stats.add_phase(std::move(p_));
+}
+
+} // tsvtree
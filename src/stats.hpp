@@ -0,0 +1,97 @@
+/* Copyright (c) 2020 - 2021 Marcelo Zimbres Silva (mzimbres at gmail dot com)
+ *
+ * This file is part of tsvtree.
+ *
+ * tsvtree is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tsvtree is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tsvtree.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstddef>
+#include <ostream>
+
+#include "utils.hpp"
+
+namespace tsvtree
+{
+
+struct phase_stats {
+   std::string name;
+   double wall = 0;
+   double cpu = 0;
+   std::size_t bytes = 0;
+   std::size_t rows = 0;
+   std::size_t allocations = 0;
+   long peak_rss_kb = 0;
+};
+
+// Statistics of a run, written to stderr with --stats. Nothing is
+// recorded unless they are enabled, the instrumented code costs then
+// only a branch.
+class run_stats {
+private:
+   bool enabled_ = false;
+   std::vector<phase_stats> phases_;
+   std::vector<std::size_t> nodes_per_depth_;
+
+public:
+   // Must be called before other threads are started.
+   void enable();
+   auto enabled() const noexcept { return enabled_; }
+
+   void add_phase(phase_stats p) { phases_.push_back(std::move(p)); }
+
+   // Set by the code that builds the tree, the last one wins.
+   void set_nodes_per_depth(std::vector<std::size_t> n)
+      { nodes_per_depth_ = std::move(n); }
+
+   void report(std::ostream& os, bool json) const;
+};
+
+extern run_stats stats;
+
+// Records a phase from construction until stop() or destruction when
+// stats are enabled.
+class phase_timer {
+private:
+   using clock_type = std::chrono::steady_clock;
+
+   bool active_;
+   phase_stats p_;
+   clock_type::time_point begin_;
+   double cpu_begin_ = 0;
+   std::size_t allocations_begin_ = 0;
+
+public:
+   phase_timer(phase_timer const&) = delete;
+   phase_timer& operator=(phase_timer const&) = delete;
+   explicit phase_timer(char const* name);
+   ~phase_timer() { stop(); }
+
+   void add(std::size_t bytes, std::size_t rows = 0) noexcept
+   {
+      p_.bytes += bytes;
+      p_.rows += rows;
+   }
+
+   void stop();
+};
+
+// Counts the nodes of each depth, if stats are enabled.
+void count_nodes_per_depth(array_view<int const> depths);
+
+} // tsvtree
@@ -30,10 +30,9 @@
 namespace tsvtree
 {
 
-tree::tree(std::string const& str, oconfig const& cfg)
+tree::tree(std::string_view str, oconfig const& cfg)
 {
-   // TODO: Catch exceptions and release already acquired memory.
-   auto const p = parse_tree(str, cfg);
+   auto const p = parse_tree(str, cfg, arena_);
    head_ = p.first;
    max_depth_ = p.second;
 }
@@ -81,16 +80,112 @@ void tree::load_leaf_counters()
    auto f = [](auto& node)
       { node.leaf_counter = node_leaf_counter(node); };
 
-   tree_postorder_view view {head_.children.front()};
-   std::for_each(std::cbegin(view), std::cend(view), f);
+   for (auto* root : head_.children) {
+      tree_postorder_view view {root};
+      std::for_each(std::cbegin(view), std::cend(view), f);
+   }
 }
 
-tree::~tree()
+// Position of the first child whose name is not less than name.
+int lower_child(tree_node const& node, std::string_view name)
 {
-   tree_postorder_view view {at({0})};
-   for (auto iter = std::begin(view); iter != std::end(view); ++iter)
-      delete iter.line().back();
+   auto const& c = node.children;
+   auto const it = std::lower_bound(std::begin(c), std::end(c), name,
+      [](auto const* p, auto const& s) { return p->name < s; });
+
+   return it - std::begin(c);
 }
 
-} // tsvtree
+// Makes room for one more child, the array grows geometrically in the
+// arena. The old one is not reused but the waste is bounded by the
+// size of the arrays.
+void grow_children(tree_node& node, arena& a)
+{
+   auto const n = tsvtree::ssize(node.children);
+   if (n < node.capacity)
+      return;
 
+   auto children = a.make_array<tree_node*>(std::max(4, 2 * n));
+   std::copy(std::begin(node.children), std::end(node.children), std::begin(children));
+   node.capacity = tsvtree::ssize(children);
+   node.children = {children.data(), n};
+}
+
+void tree::build(std::vector<tsv_row> rows, int threads)
+{
+   sort_rows(rows, threads);
+
+   // The nodes on the path of the previous row.
+   std::vector<tree_node*> path;
+   tsv_row prev;
+   for (auto const& row : rows) {
+      auto const n = std::min(prev.n, row.n);
+      auto lcp = 0;
+      while (lcp < n && prev[lcp] == row[lcp])
+         ++lcp;
+
+      path.resize(lcp);
+      auto* node = lcp == 0 ? &head_ : path.back();
+      for (auto d = lcp; d < row.n; ++d) {
+         auto* child = arena_.make<tree_node>(arena_.copy(row[d]));
+         grow_children(*node, arena_);
+         node->children = {node->children.data(), tsvtree::ssize(node->children) + 1};
+         node->children.back() = child;
+         path.push_back(child);
+         node = child;
+      }
+
+      max_depth_ = std::max(max_depth_, row.n - 1);
+      prev = row;
+   }
+
+   load_leaf_counters();
+}
+
+int tree::insert(std::vector<std::string_view> const& row)
+{
+   auto const n = tsvtree::ssize(row);
+   auto* node = &head_;
+   auto depth = 0;
+
+   // The existing part of the path.
+   std::vector<tree_node*> path;
+   for (; depth < n; ++depth) {
+      auto const pos = lower_child(*node, row[depth]);
+      if (pos == tsvtree::ssize(node->children) || node->children[pos]->name != row[depth])
+         break;
+
+      node = node->children[pos];
+      path.push_back(node);
+   }
+
+   if (depth == n)
+      return n;
+
+   // A leaf that gets children still accounts for one leaf, otherwise
+   // there is one more leaf under each node on the path.
+   if (!std::empty(node->children) || node == &head_)
+      for (auto* p : path)
+         ++p->leaf_counter;
+   else
+      node->leaf_counter = 1;
+
+   for (auto d = depth; d < n; ++d) {
+      auto const pos = lower_child(*node, row[d]);
+      auto* child = arena_.make<tree_node>(arena_.copy(row[d]));
+      child->leaf_counter = d + 1 < n ? 1 : 0;
+
+      grow_children(*node, arena_);
+      node->children = {node->children.data(), tsvtree::ssize(node->children) + 1};
+      std::copy_backward(std::begin(node->children) + pos,
+                         std::end(node->children) - 1,
+                         std::end(node->children));
+      node->children[pos] = child;
+      node = child;
+   }
+
+   max_depth_ = std::max(max_depth_, n - 1);
+   return depth;
+}
+
+} // tsvtree
@@ -21,8 +21,11 @@
 #include <vector>
 #include <string>
 #include <limits>
+#include <string_view>
 
+#include "tsv.hpp"
 #include "utils.hpp"
+#include "arena.hpp"
 #include "tree_node.hpp"
 #include "tree_view.hpp"
 #include "tree_utils.hpp"
@@ -30,8 +33,11 @@
 namespace tsvtree
 {
 
+// The nodes are owned by the arena, releasing the tree frees a few
+// large blocks instead of each node.
 class tree {
 private:
+   arena arena_;
    tree_node head_;
    int max_depth_ = 0;
  
@@ -40,13 +46,32 @@ public:
    tree& operator=(tree const&) = delete;
    tree(tree&&) = delete;
    tree& operator=(tree&&) = delete;
-   tree(std::string const& str, oconfig const& conf);
-   ~tree();
+   tree(std::string_view str, oconfig const& conf);
+
+   // An empty tree, to be filled with insert.
+   tree() = default;
 
    bool empty() const noexcept { return std::empty(head_.children); }
    bool max_depth() const noexcept {return max_depth_;};
    void load_leaf_counters();
 
+   // Fills an empty tree with tsv rows, which are sorted first so that
+   // the nodes of each row are appended after the longest common
+   // prefix with the previous one, as in the tsv builder. Loads the
+   // leaf counters.
+   void build(std::vector<tsv_row> rows, int threads = 1);
+
+   // Inserts the nodes of a tsv row that are not in the tree yet,
+   // keeping the children sorted as in the output of the tsv builder,
+   // and updates the leaf counters on its path. Returns the depth of
+   // the first new node, or the size of the row if there is none. The
+   // leaf counters must have been loaded.
+   int insert(std::vector<std::string_view> const& row);
+
+   // The nodes on depth 0, there is more than one when the tree is
+   // built with insert from rows with different first fields.
+   auto const& roots() const noexcept { return head_.children; }
+
    // Returns a pointer to the node at the specified position in the tree where
    // [0] is the root node.
    //
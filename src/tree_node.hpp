@@ -18,18 +18,25 @@
 
 #pragma once
 
-#include <deque>
-#include <vector>
-#include <string>
+#include <string_view>
+
+#include "utils.hpp"
 
 namespace tsvtree
 {
 
+// Nodes are allocated in the arena owned by the tree, the name and
+// children point into it as well. The coordinate of a node is not
+// stored, the traversals keep track of it, see tree_cursor.
 struct tree_node {
-   std::string name;
-   std::vector<int> code;
+   std::string_view name;
    int leaf_counter = 0;
-   std::deque<tree_node*> children;
+
+   // Room for children in the array, only used when nodes are
+   // inserted, see tree::insert. Zero means the array is full.
+   int capacity = 0;
+
+   array_view<tree_node*> children;
 };
 
 } // tsvtree
@@ -18,22 +18,34 @@
 
 #include "tree_parser.hpp"
 
-#include <stack>
 #include <vector>
 #include <cassert>
-#include <sstream>
+#include <charconv>
 #include <iterator>
 #include <algorithm>
 #include <exception>
 
 #include "utils.hpp"
 #include "tree.hpp"
+#include "arena.hpp"
+#include "flat_tree.hpp"
 
 namespace tsvtree
 {
 
+auto to_depth(std::string_view digits)
+{
+   int ret = 0;
+   auto const* end = digits.data() + std::size(digits);
+   auto const r = std::from_chars(digits.data(), end, ret);
+   if (r.ec != std::errc {})
+      throw std::runtime_error("Invalid depth.");
+
+   return ret;
+}
+
 auto
-remove_depth(std::string& line,
+remove_depth(std::string_view& line,
              oconfig::format ifmt,
              char field_sep)
 {
@@ -42,10 +54,10 @@ remove_depth(std::string& line,
 
    if (ifmt == oconfig::format::tree) {
       auto const i = line.find_first_not_of('\t');
-      if (i == std::string::npos)
+      if (i == std::string_view::npos)
          throw std::runtime_error("Invalid line.");
 
-      line.erase(0, i);
+      line.remove_prefix(i);
       return static_cast<int>(i);
    }
 
@@ -54,49 +66,60 @@ remove_depth(std::string& line,
          return -1;
 
       auto const p1 = line.find_first_of(field_sep);
-      if (p1 == std::string::npos)
+      if (p1 == std::string_view::npos)
          throw std::runtime_error("No field separator found in line.");
 
       auto const p2 = line.find_first_of(field_sep, p1 + 1);
-      if (p2 == std::string::npos) {
-         auto const digit = line.substr(0, p1);
-         line.erase(0, p1 + 1);
+      if (p2 == std::string_view::npos) {
+         auto const depth = to_depth(line.substr(0, p1));
+         line.remove_prefix(p1 + 1);
          // Now the line contains only the middle field.
-         return std::stoi(digit);
+         return depth;
       }
 
       // The middle data cannot be empty.
       if (p2 == p1 + 1)
          throw std::runtime_error("Invalid line.");
 
-      auto const digit = line.substr(0, p1);
-      line.erase(0, p1 + 1);
-      line.erase(p2);
+      auto const depth = to_depth(line.substr(0, p1));
+      line = line.substr(p1 + 1, p2 - p1 - 1);
 
       // Now the line contains only the middle field.
-      return std::stoi(digit);
+      return depth;
    }
 
    return -1;
 }
 
-auto first_line(std::string const& tree_str, char line_break)
+auto first_line(std::string_view tree_str, char line_break)
 {
-   std::stringstream ss(tree_str);
-   std::string line;
-   while (std::getline(ss, line, line_break))
+   while (!std::empty(tree_str)) {
+      auto const p = tree_str.find(line_break);
+      auto const line = tree_str.substr(0, p);
       if (!std::empty(line))
          return line;
 
-   return std::string {};
+      if (p == std::string_view::npos)
+         break;
+
+      tree_str.remove_prefix(p + 1);
+   }
+
+   return std::string_view {};
 }
 
 oconfig::format
-detect_iformat(std::string const& tree_str,
+detect_iformat(std::string_view tree_str,
                char line_break,
                char field_sep,
                bool tsv)
 {
+   if (is_binary(tree_str))
+      return oconfig::format::bin;
+
+   if (is_comp_binary(tree_str))
+      return oconfig::format::comp_bin;
+
    if (tsv)
       return oconfig::format::tsv;
 
@@ -112,97 +135,122 @@ detect_iformat(std::string const& tree_str,
    return oconfig::format::tree;
 }
 
+bool node_reader::next(int& depth, std::string_view& name)
+{
+   // Deeper lines are ignored.
+   constexpr auto max_allowed_depth = 1000;
+
+   while (pos_ < std::size(str_)) {
+      auto const i = lines_.next();
+      auto line = str_.substr(pos_, i - pos_);
+      pos_ = i + 1;
+
+      auto const d = remove_depth(line, fmt_, field_sep_);
+      if (d == -1)
+         continue;
+
+      if (d > max_depth_)
+         max_depth_ = d;
+
+      if (last_depth_ == -1) {
+         last_depth_ = 0;
+         depth = 0;
+         name = line;
+         return true;
+      }
+
+      if (d == 0)
+         throw std::runtime_error("Unknown file input format.");
+
+      if (d >= max_allowed_depth)
+         continue;
+
+      if (d > last_depth_ + 1)
+         throw std::runtime_error("Forward jump not allowed.");
+
+      last_depth_ = d;
+      depth = d;
+      name = line;
+      return true;
+   }
+
+   return false;
+}
+
 class tree_parser {
 private:
-   std::vector<int> codes_;
-   std::stack<tree_node*> stack_;
-   int last_depth_ = 0;
+   arena& arena_;
    tree_node head_;
-   int max_depth_ = 0;
 
-public:
-   tree_parser(int max_depth) : codes_(max_depth, -1) { }
-   auto head() const noexcept {return head_;};
-   auto max_depth() const noexcept {return max_depth_;};
-   void add_line(std::string line, oconfig const& cfg)
+   // The nodes on the path to the last line and the children collected
+   // so far for each of them. The children are moved into the arena
+   // once the node is complete, so their number is known.
+   std::vector<tree_node*> open_;
+   std::vector<std::vector<tree_node*>> children_;
+
+   auto make_node(std::string_view name)
+   {
+      return arena_.make<tree_node>(arena_.copy(name));
+   }
+
+   void close(int depth)
    {
-      auto const depth =
-         remove_depth(line,
-                      cfg.fmt,
-                      cfg.field_sep);
-
-      if (depth == -1)
-         return;
-
-      if (depth > max_depth_)
-         max_depth_ = depth;
-
-      if (std::empty(head_.children)) {
-         auto* p = new tree_node {line, {0}};
-         head_.children.push_front(p);
-         stack_.push(p);
-         return;
+      while (tsvtree::ssize(open_) > depth) {
+         auto const i = tsvtree::ssize(open_) - 1;
+         open_.back()->children = arena_.copy(children_[i]);
+         children_[i].clear();
+         open_.pop_back();
       }
+   }
 
-      if (depth == 0)
-         throw std::runtime_error("Unknown file input format.");
+   void push(tree_node* p)
+   {
+      if (!std::empty(open_))
+         children_[tsvtree::ssize(open_) - 1].push_back(p);
+
+      open_.push_back(p);
+      if (std::size(children_) < std::size(open_))
+         children_.resize(std::size(open_));
+   }
 
-      if (tsvtree::ssize(codes_) <= depth)
-         return; // Line is ignored.
-
-      ++codes_.at(depth - 1);
-      for (auto i = depth; i < tsvtree::ssize(codes_); ++i)
-         codes_[i] = -1;
-
-      std::vector<int> code {0};
-      code.insert(std::end(code), std::cbegin(codes_), std::cbegin(codes_) + depth);
-
-      if (depth > last_depth_) {
-         if (last_depth_ + 1 != depth)
-            throw std::runtime_error("Forward jump not allowed.");
-
-         // We found the child of the last node pushed on the stack.
-         auto* p = new tree_node {line, code};
-         stack_.top()->children.push_front(p);
-         stack_.push(p);
-         ++last_depth_;
-      } else if (depth < last_depth_) {
-         // Now we have to pop that number of nodes from the stack
-         // until we get to the node that is should be the parent of
-         // the current line.
-         auto const delta_depth = last_depth_ - depth;
-         for (auto i = 0; i < delta_depth; ++i)
-            stack_.pop();
-
-         stack_.pop();
-
-         // Now we can add the new node.
-         auto* p = new tree_node {line, code};
-         stack_.top()->children.push_front(p);
-         stack_.push(p);
-
-         last_depth_ = depth;
-      } else {
-         stack_.pop();
-         auto* p = new tree_node {line, code};
-         stack_.top()->children.push_front(p);
-         stack_.push(p);
-         // Last depth stays equal.
+public:
+   explicit tree_parser(arena& a) : arena_ {a} { }
+
+   auto head()
+   {
+      if (!std::empty(open_)) {
+         std::vector<tree_node*> const root {open_.front()};
+         close(0);
+         head_.children = arena_.copy(root);
       }
+
+      return head_;
+   }
+
+   void add_node(int depth, std::string_view name)
+   {
+      // Pops the nodes until we get to the parent of the current line.
+      close(depth);
+      push(make_node(name));
    }
 };
 
 std::pair<tree_node, int>
-parse_tree(std::string const& tree_str, oconfig const& cfg)
+parse_tree(std::string_view tree_str, oconfig const& cfg, arena& a)
 {
-   // TODO: Make it exception safe.
-   std::stringstream ss(tree_str);
-   std::string line;
-   tree_parser p {1000};
-   while (std::getline(ss, line, cfg.line_break))
-      p.add_line(std::move(line), cfg);
-
-   return std::make_pair(p.head(), p.max_depth());
+   // Binary trees are only read by flat_tree.
+   if (cfg.fmt == oconfig::format::bin || cfg.fmt == oconfig::format::comp_bin)
+      throw std::runtime_error("Binary input is not supported by this operation.");
+
+   node_reader reader {tree_str, cfg};
+   tree_parser p {a};
+
+   int depth;
+   std::string_view name;
+   while (reader.next(depth, name))
+      p.add_node(depth, name);
+
+   return std::make_pair(p.head(), reader.max_depth());
 }
 
 } // tsvtree
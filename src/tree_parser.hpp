@@ -16,19 +16,52 @@
  * along with tsvtree.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#pragma once
+
 #include <string>
 #include <utility>
+#include <string_view>
 
+#include "scan.hpp"
 #include "tree_node.hpp"
+#include "tree_utils.hpp"
 
 namespace tsvtree
 {
 
-struct oconfig;
+class arena;
+
+// Reads the nodes of a tree in tree or comp format in the order they
+// appear in the input, checking that their depths are consistent.
+// The root node has always depth 0.
+class node_reader {
+private:
+   std::string_view str_;
+   delim_scanner lines_;
+   std::size_t pos_ = 0;
+   oconfig::format fmt_;
+   char field_sep_;
+   int last_depth_ = -1;
+   int max_depth_ = 0;
+
+public:
+   node_reader(std::string_view str, oconfig const& cfg)
+   : str_ {str}
+   , lines_ {str, cfg.line_break, cfg.line_break}
+   , fmt_ {cfg.fmt}
+   , field_sep_ {cfg.field_sep}
+   { }
+
+   // Returns false when there are no more nodes.
+   bool next(int& depth, std::string_view& name);
+
+   // The maximum depth found in the input so far.
+   auto max_depth() const noexcept {return max_depth_;};
+};
 
 // Parses the three contained in tree_str and puts its root node in
-// root.children.
+// root.children. The nodes are allocated in the arena.
 std::pair<tree_node, int>
-parse_tree(std::string const& tree_str, oconfig const& cfg);
+parse_tree(std::string_view tree_str, oconfig const& cfg, arena& a);
 
 } // tsvtree
@@ -32,6 +32,8 @@
 #include <exception>
 
 #include "tree_parser.hpp"
+#include "flat_tree.hpp"
+#include "output.hpp"
 #include "utils.hpp"
 #include "tsv.hpp"
 
@@ -46,87 +48,88 @@ auto const* tikz_node =
 auto const* tikz_arrow =
    "\\treearrow[color=arrowC] ({}.west) to ({}pt, {}pt) to ({}.south west);";
 
-auto
-node_dump(tree_node const& node,
+void
+node_dump(output_sink& os,
+          std::string_view name,
+          array_view<int const> code,
+          int depth,
           oconfig::format of,
           char field_sep,
-          std::vector<bool> const& lasts,
+          std::string_view deco,
 	  int line,
-	  oconfig::tikz const& conf,
-          int at_depth)
+	  oconfig::tikz const& conf)
 {
-   auto const depth = tsvtree::ssize(node.code) - at_depth;
-   assert(depth >= 0);
-
    if (of == oconfig::format::tree) {
-      std::string ret(depth, '\t');
-      ret += node.name;
-      return ret;
+      for (auto i = 0; i < depth; ++i)
+         os << '\t';
+      os << name;
+      return;
    }
 
    if (of == oconfig::format::comp) {
-      std::string ret;
-      ret += std::to_string(depth);
-      ret += field_sep;
-      ret += node.name;
-      return ret;
+      os << depth << field_sep << name;
+      return;
    }
 
    if (of == oconfig::format::tree_deco) {
-      auto ret = make_deco_indent(depth, lasts);
-      ret += node.name;
-      return ret;
+      os << deco << name;
+      return;
    }
 
    if (of == oconfig::format::tikz) {
       auto const x = depth * conf.x_step;
       auto y = - line * conf.y_step;
 
-      auto const name = "n" + to_string(node.code, '-');
-      auto node_line = fmt::format(tikz_node, depth, name, x, y, node.name);
+      auto const id = "n" + to_string(code, '-');
+      os << fmt::format(tikz_node, depth, id, x, y, name);
 
       if (depth == 0)
-         return node_line;
+         return;
 
       std::vector<int> const parent_code =
-         {std::begin(node.code), std::prev(std::end(node.code))};
+         {std::begin(code), std::prev(std::end(code))};
 
       auto const parent_name = "n" + to_string(parent_code, '-');
       y += conf.y_step / 2;
-      node_line += "\n";
-      node_line +=
-         fmt::format(tikz_arrow, name, (depth - 1) * conf.x_step, y, parent_name);
+      os << '\n'
+         << fmt::format(tikz_arrow, id, (depth - 1) * conf.x_step, y, parent_name);
 
-      return node_line;
+      return;
    }
 
-   return to_string(node.code);
+   os << to_string(code);
 }
 
-std::string
-serialize(tree_node* p,
+void
+serialize(flat_tree const& t,
+          int root,
           oconfig::format of,
           char line_break,
           int max_depth,
-          int at_depth,
           char field_sep,
-	  oconfig::tikz const& conf)
+          output_sink& os,
+	  oconfig::tikz const& conf,
+          std::vector<char> const* selection)
 {
-   tree_tsv_view view {p, max_depth};
-
-   std::string ret;
+   deco_prefix prefix;
+   std::string_view deco;
    int line = 0;
-   for (auto iter = std::begin(view); iter != std::end(view); ++iter) {
-      ret += node_dump(*iter,
-		       of,
-		       field_sep,
-		       iter.lasts(),
-		       line++,
-		       conf,
-                       at_depth);
-      ret += line_break;
+   for (flat_tsv_traversal iter {t, root, max_depth, selection}; !iter.done(); iter.next()) {
+      auto const d = iter.depth();
+      if (of == oconfig::format::tree_deco)
+         deco = prefix.next(d, iter.last());
+
+      node_dump(os,
+                t.name(iter.node()),
+                iter.code(),
+                d,
+		of,
+		field_sep,
+		deco,
+		line++,
+		conf);
+      os << line_break;
    }
-   return ret;
 }
 
 std::string
@@ -161,4 +164,25 @@ std::string check_min_depth(tree_level_view view, int min_depth)
    return {};
 }
 
+void
+write_leaf_paths(flat_tree const& t,
+                 int root,
+                 int max_depth,
+                 char field_sep,
+                 output_sink& os,
+                 std::vector<char> const* selection)
+{
+   for (flat_tsv_traversal iter {t, root, max_depth, selection}; !iter.done(); iter.next()) {
+      if (!iter.at_bottom())
+         continue;
+
+      auto const& path = iter.path();
+      os << t.name(path.front());
+      for (auto i = 1; i < tsvtree::ssize(path); ++i)
+         os << field_sep << t.name(path[i]);
+
+      os << '\n';
+   }
+}
+
 } // tsvtree
@@ -23,6 +23,7 @@
 #include <vector>
 #include <string>
 #include <limits>
+#include <string_view>
 
 #include "utils.hpp"
 #include "tree_node.hpp"
@@ -39,6 +40,8 @@ struct oconfig {
    , info
    , tsv
    , tikz
+   , bin
+   , comp_bin
    , check_min_depth
    , invalid
    };
@@ -84,21 +87,41 @@ std::string check_min_depth(tree_level_view view, int min_depth);
  *       |1;f
  *
  * To do it we can read the first line and count the number of
- * field separators. If it is not zero, it is format 2.
+ * field separators. If it is not zero, it is format 2. Trees in
+ * binary and compressed binary format are recognized by their header,
+ * also when tsv is set.
  */
 oconfig::format
-detect_iformat(std::string const& tree_str,
+detect_iformat(std::string_view tree_str,
                char line_break,
                char field_sep,
                bool tsv);
 
-std::string
-serialize(tree_node* p,
+class flat_tree;
+class output_sink;
+
+// Writes the subtree rooted at node root up to max_depth levels below
+// it, node by node. Only the nodes kept in selection are written, if
+// given, see select_nodes.
+void
+serialize(flat_tree const& t,
+          int root,
           oconfig::format of,
           char line_sep,
           int max_depth,
-          int at_depth,
           char field_sep,
-	  oconfig::tikz const& conf = {});
+          output_sink& os,
+	  oconfig::tikz const& conf = {},
+          std::vector<char> const* selection = nullptr);
+
+// Writes each leaf of the subtree rooted at node root, or each node
+// max_depth levels below it, as a tsv row with its parents (-o tsv).
+void
+write_leaf_paths(flat_tree const& t,
+                 int root,
+                 int max_depth,
+                 char field_sep,
+                 output_sink& os,
+                 std::vector<char> const* selection = nullptr);
 
 } // tsvtree
@@ -23,99 +23,113 @@
 namespace tsvtree
 {
 
-// Returns a vector containing all parents of a leaf node. Represents
-// a line in the tsv file.
-line_type parents(std::deque<std::deque<tree_node*>> const& st)
+tree_cursor::tree_cursor(tree_node* root, int depth)
+: max_depth_ {depth}
 {
-   line_type r;
-   for (auto iter = std::cbegin(st); iter != std::cend(st); ++iter)
-      if (!std::empty(*iter))
-         r.push_back(iter->back());
+   if (!root)
+      return;
 
-   return r;
+   path_.push_back(root);
+   code_.push_back(0);
 }
 
-tree_post_order_traversal::
-tree_post_order_traversal(tree_node* root, int depth)
-: depth_(depth)
-, lasts_(depth > 1000 ? 1000 : depth)
+bool tree_cursor::has_next_sibling() const noexcept
+{
+   // The root of the traversal has no siblings.
+   auto const n = tsvtree::ssize(path_);
+   return n > 1 && code_.back() + 1 < path_[n - 2]->children.size();
+}
+
+void tree_cursor::next_sibling() noexcept
 {
-   if (root)
-      st_.push_back({root});
+   auto const n = tsvtree::ssize(path_);
+   path_.back() = path_[n - 2]->children[++code_.back()];
 }
 
-line_type tree_post_order_traversal::advance()
+void tree_cursor::descend()
 {
-   while (!std::empty(st_.back().back()->children) && (tsvtree::ssize(st_) <= depth_))
-      st_.push_back(st_.back().back()->children);
+   path_.push_back(current()->children.front());
+   code_.push_back(0);
+}
 
-   auto tmp = parents(st_);
-   st_.back().pop_back();
-   return tmp;
+void tree_cursor::ascend() noexcept
+{
+   path_.pop_back();
+   code_.pop_back();
 }
 
-line_type tree_post_order_traversal::next_internal()
+//-------------------------------------------------------------------
+tree_post_order_traversal::
+tree_post_order_traversal(tree_node* root, int depth)
+: tree_cursor {root, depth}
 {
-   st_.pop_back();
-   if (std::empty(st_))
-      return line_type {};
+   if (!done())
+      descend_all();
+}
 
-   auto tmp = parents(st_);
-   st_.back().pop_back();
-   return tmp;
+void tree_post_order_traversal::descend_all()
+{
+   while (can_descend())
+      descend();
 }
 
-line_type tree_post_order_traversal::next_leaf_node()
+void tree_post_order_traversal::next_leaf_node()
 {
-   while (std::empty(st_.back()))
-      if (std::empty(next_internal()))
-         return line_type {};
+   // The parents are skipped.
+   while (!has_next_sibling()) {
+      ascend();
+      if (done())
+         return;
+   }
 
-   return advance();
+   next_sibling();
+   descend_all();
 }
 
-line_type tree_post_order_traversal::next_node()
+void tree_post_order_traversal::next_node()
 {
-   if (std::empty(st_.back()))
-      return next_internal();
+   if (!has_next_sibling()) {
+      ascend();
+      return;
+   }
 
-   return advance();
+   next_sibling();
+   descend_all();
 }
 
 //-------------------------------------------------------------------
 tree_tsv_traversal::tree_tsv_traversal(tree_node* root, int depth)
-: depth_(depth)
-, lasts_(depth > 1000 ? 1000 : depth)
+: tree_cursor {root, depth}
 {
-   if (root)
-      st_.push_back({root});
+   if (!done())
+      update_lasts();
 }
 
-line_type tree_tsv_traversal::advance()
+void tree_tsv_traversal::update_lasts()
 {
-   auto line = parents(st_);
-   st_.back().pop_back();
-
    auto const d = depth() == 0 ? 0 : depth() - 1;
-   lasts_[d] = std::empty(st_.back());
+   if (tsvtree::ssize(lasts_) <= d)
+      lasts_.resize(d + 1);
 
-   if (!std::empty(line.back()->children) && tsvtree::ssize(st_) <= depth_)
-      st_.push_back(line.back()->children);
-
-   return line;
+   lasts_[d] = !has_next_sibling();
 }
 
-line_type tree_tsv_traversal::next()
+void tree_tsv_traversal::next()
 {
-   while (std::empty(st_.back())) {
-      st_.pop_back();
-      if (std::empty(st_))
-         return line_type {};
+   if (can_descend()) {
+      descend();
+      update_lasts();
+      return;
    }
 
-   return advance();
-}
+   while (!has_next_sibling()) {
+      ascend();
+      if (done())
+         return;
+   }
 
+   next_sibling();
+   update_lasts();
 }
 
-
+}
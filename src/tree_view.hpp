@@ -18,8 +18,6 @@
 
 #pragma once
 
-#include <stack>
-#include <deque>
 #include <vector>
 #include <string>
 #include <limits>
@@ -32,55 +30,83 @@ namespace tsvtree
 
 using line_type = std::vector<tree_node*>;
 
-class tree_post_order_traversal {
+// The path from the root of a traversal to its current node together
+// with the position of each node on it among its siblings, i.e. its
+// coordinate. Moving to another node changes only the end of both, so
+// that traversals do not allocate once the buffers have grown to the
+// depth of the tree.
+class tree_cursor {
+protected:
+   line_type path_;
+   std::vector<int> code_;
+   int max_depth_;
+
+   auto current() const noexcept { return path_.back(); }
+
+   auto can_descend() const noexcept
+   {
+      return !std::empty(current()->children)
+          && tsvtree::ssize(path_) <= max_depth_;
+   }
+
+   bool has_next_sibling() const noexcept;
+   void next_sibling() noexcept;
+   void descend();
+   void ascend() noexcept;
+
+public:
+   tree_cursor(tree_node* root, int depth);
+
+   auto done() const noexcept { return std::empty(path_); }
+   auto depth() const noexcept { return tsvtree::ssize(path_) - 1; }
+   auto const& line() const noexcept { return path_; }
+   auto const& code() const noexcept { return code_; }
+};
+
+// Visits the children of a node before the node itself.
+class tree_post_order_traversal : public tree_cursor {
 private:
-   std::deque<std::deque<tree_node*>> st_;
-   int depth_;
-   std::vector<bool> lasts_;
+   void descend_all();
 
 public:
    tree_post_order_traversal(tree_node* root, int depth);
-   auto depth() const noexcept { return tsvtree::ssize(st_) - 1; }
-   auto const& lasts() const noexcept { return lasts_;}
-   line_type advance();
-   line_type next_internal();
-   line_type next_leaf_node();
-   line_type next_node();
+
+   // Visits only the nodes at the bottom i.e. leaves and the nodes at
+   // the maximum depth.
+   void next_leaf_node();
+   void next_node();
 };
 
 // Traverses the tree in the same order as it appears in the tsv file.
-class tree_tsv_traversal {
+class tree_tsv_traversal : public tree_cursor {
 private:
-   std::deque<std::deque<tree_node*>> st_;
-   int depth_ = -1;
    std::vector<bool> lasts_;
 
+   void update_lasts();
+
 public:
    tree_tsv_traversal(tree_node* root, int depth);
-   auto depth() const noexcept { return tsvtree::ssize(st_) - 1; }
+
+   // Whether the nodes on the current path are the last child of their
+   // parents, the entry for depth d is at d - 1.
    auto const& lasts() const noexcept { return lasts_;}
-   line_type next();
-   line_type advance();
+   void next();
 };
 
 template <int N>
-class tree_traversal {
-private:
-   tree_post_order_traversal t_;
-
+class tree_traversal : public tree_post_order_traversal {
 public:
-   tree_traversal(tree_node* root, int depth) : t_{root, depth} { }
-   auto advance() { return t_.advance();}
-   auto depth() const noexcept { return t_.depth(); }
-   auto lasts() const noexcept { return t_.lasts(); }
+   tree_traversal(tree_node* root, int depth)
+   : tree_post_order_traversal {root, depth}
+   { }
 
    template <int M = N>
-   typename std::enable_if<M == 0, line_type>::type
-   next() { return t_.next_leaf_node(); }
+   typename std::enable_if<M == 0>::type
+   next() { next_leaf_node(); }
 
    template <int M = N>
-   typename std::enable_if<M == 1, line_type>::type
-   next() { return t_.next_node(); }
+   typename std::enable_if<M == 1>::type
+   next() { next_node(); }
 };
 
 template <int N> struct tree_iter_impl    { using type = tree_traversal<N>; };
@@ -90,7 +116,6 @@ template <int N>
 class tree_iterator {
 private:
    typename tree_iter_impl<N>::type iter_;
-   std::vector<tree_node*> current_;
 
 public:
    using value_type = tree_node;
@@ -106,17 +131,14 @@ public:
    tree_iterator(tree_node* root = nullptr,
                  int depth = std::numeric_limits<int>::max())
    : iter_ {root, depth}
-   { 
-      if (root)
-         current_ = iter_.advance();
-   }
+   { }
 
-   reference operator*() { return *current_.back();}
-   const_reference const& operator*() const { return *current_.back();}
+   reference operator*() { return *iter_.line().back();}
+   const_reference const& operator*() const { return *iter_.line().back();}
 
    tree_iterator& operator++()
    {
-      current_ = iter_.next();
+      iter_.next();
       return *this;
    }
 
@@ -128,21 +150,21 @@ public:
    }
 
    pointer operator->()
-      {return current_.back();}
+      {return iter_.line().back();}
 
    const_pointer operator->() const
-      {return current_.back();}
+      {return iter_.line().back();}
 
    friend
    auto operator==(tree_iterator const& a, tree_iterator const& b)
    {
-      if (std::empty(a.current_) && std::empty(b.current_))
+      if (a.iter_.done() && b.iter_.done())
          return true;
 
-      if (std::empty(a.current_) || std::empty(b.current_))
+      if (a.iter_.done() || b.iter_.done())
          return false;
 
-      return a.current_.back() == b.current_.back();
+      return a.iter_.line().back() == b.iter_.line().back();
    }
 
    friend
@@ -150,7 +172,8 @@ public:
       { return !(a == b); }
 
    auto depth() const noexcept { return iter_.depth(); }
-   auto const& line() const noexcept { return current_; }
+   auto const& line() const noexcept { return iter_.line(); }
+   auto const& code() const noexcept { return iter_.code(); }
    auto const& lasts() const noexcept { return iter_.lasts(); }
 };
 
@@ -18,179 +18,825 @@
 
 #include "tsv.hpp"
 
-#include <stack>
-#include <deque>
 #include <vector>
 #include <string>
 #include <cassert>
-#include <fstream>
-#include <iomanip>
-#include <sstream>
+#include <cmath>
+#include <cstdint>
+#include <charconv>
+#include <stdexcept>
 #include <iterator>
 #include <iostream>
 #include <algorithm>
+#include <functional>
+#include <thread>
 
 #include "utils.hpp"
+#include "input.hpp"
+#include "scan.hpp"
+#include "output.hpp"
+#include "stats.hpp"
+#include "hash_trie.hpp"
 
 namespace tsvtree
 {
 
-struct line_comp {
-   int depth;
-   auto operator()( std::vector<std::string> const& v1
-                  , std::vector<std::string> const& v2) const
-   { return v1.at(depth) < v2.at(depth); };
-};
+void
+write_tree_line(output_sink& os,
+                std::string_view name,
+                int depth,
+                int indent_size,
+                char out_field_sep,
+                std::string_view deco,
+                bool decorate)
+{
+   if (indent_size < 0) {
+      os << depth << out_field_sep << name;
+      return;
+   }
 
-struct line_comp_pred {
-   std::string s;
-   int depth;
-   auto operator()(std::vector<std::string> const& v) const
-   { return s == v.at(depth); }
-};
+   if (decorate) {
+      os << deco << name;
+      return;
+   }
+
+   for (auto i = 0; i < depth; ++i)
+      os << '\t';
+
+   os << name;
+}
 
-struct range {
-   using iter_type = std::vector<std::vector<std::string>>::iterator;
-   iter_type begin;
-   iter_type end;
-   int depth;
+// Lexicographic order of the rows, each field compared only once.
+bool row_less(tsv_row const& a, tsv_row const& b) noexcept
+{
+   auto const n = std::min(a.n, b.n);
+   for (auto i = 0; i < n; ++i) {
+      auto const c = a.fields[i].compare(b.fields[i]);
+      if (c != 0)
+         return c < 0;
+   }
+
+   return a.n < b.n;
+}
+
+// The rows are sorted together with a key made of the first bytes of
+// their fields, which decides most comparisons without following the
+// pointers to the fields.
+struct sort_item {
+   std::uint64_t key;
+   tsv_row row;
 };
 
-auto
-make_tree_line(std::string const& name,
-               int depth,
-               int indent_size,
-               char out_field_sep,
-               std::vector<bool> const& lasts,
-	       bool decorate)
+bool item_less(sort_item const& a, sort_item const& b) noexcept
 {
-   if (indent_size < 0) {
-      auto ret = std::to_string(depth);
-      ret += out_field_sep;
-      ret += name;
-      return ret;
+   if (a.key != b.key)
+      return a.key < b.key;
+
+   return row_less(a.row, b.row);
+}
+
+// Packs the fields separated by zero bytes into a big-endian integer,
+// whose order agrees with row_less as long as the fields themselves
+// don't contain zero bytes. Returns false otherwise.
+bool make_key(tsv_row const& row, std::uint64_t& key) noexcept
+{
+   key = 0;
+   auto bytes = 0;
+   for (auto i = 0; i < row.n && bytes < 8; ++i) {
+      if (i != 0) {
+         key <<= 8;
+         ++bytes;
+      }
+
+      for (auto c : row.fields[i]) {
+         if (bytes == 8)
+            break;
+
+         if (c == '\0')
+            return false;
+
+         key = (key << 8) | static_cast<unsigned char>(c);
+         ++bytes;
+      }
    }
 
-   if (decorate) {
-     auto ret = make_deco_indent(depth, lasts);
-     ret += name;
-     return ret;
+   key <<= 8 * (8 - bytes);
+   return true;
+}
+
+// Minimum number of rows worth handing to another thread.
+constexpr std::ptrdiff_t parallel_cutoff = 1 << 14;
+
+using item_iter = std::vector<sort_item>::iterator;
+
+void
+parallel_merge(item_iter a1,
+               item_iter a2,
+               item_iter b1,
+               item_iter b2,
+               item_iter out,
+               int threads)
+{
+   if (threads <= 1 || (a2 - a1) + (b2 - b1) < parallel_cutoff) {
+      std::merge(a1, a2, b1, b2, out, item_less);
+      return;
+   }
+
+   // Splits the larger sequence in the middle and the other one at
+   // the corresponding position, the halves are merged independently.
+   if (a2 - a1 < b2 - b1) {
+      std::swap(a1, b1);
+      std::swap(a2, b2);
+   }
+
+   auto const am = a1 + (a2 - a1) / 2;
+   auto const bm = std::lower_bound(b1, b2, *am, item_less);
+   auto const out_m = out + (am - a1) + (bm - b1);
+
+   std::thread t {parallel_merge, a1, am, b1, bm, out, threads / 2};
+   parallel_merge(am, a2, bm, b2, out_m, threads - threads / 2);
+   t.join();
+}
+
+void
+parallel_sort(item_iter first,
+              item_iter last,
+              item_iter buffer,
+              int threads)
+{
+   if (threads <= 1 || last - first < parallel_cutoff) {
+      std::sort(first, last, item_less);
+      return;
+   }
+
+   auto const mid = first + (last - first) / 2;
+   std::thread t {parallel_sort, first, mid, buffer, threads / 2};
+   parallel_sort(mid, last, buffer + (mid - first), threads - threads / 2);
+   t.join();
+
+   parallel_merge(first, mid, mid, last, buffer, threads);
+   std::copy(buffer, buffer + (last - first), first);
+}
+
+void sort_rows(std::vector<tsv_row>& rows, int threads)
+{
+   std::vector<sort_item> items(std::size(rows));
+   auto keys = true;
+   for (auto i = 0; i < tsvtree::ssize(rows); ++i) {
+      items[i].row = rows[i];
+      keys = make_key(rows[i], items[i].key) && keys;
    }
 
-   auto ret = std::string(depth, '\t');
-   ret += name;
+   if (!keys) {
+      for (auto& item : items)
+         item.key = 0;
+   }
+
+   std::vector<sort_item> buffer(threads > 1 ? std::size(items) : 0);
+   parallel_sort(std::begin(items), std::end(items), std::begin(buffer), threads);
+
+   for (auto i = 0; i < tsvtree::ssize(rows); ++i)
+      rows[i] = items[i].row;
+}
+
+// Only finite values, min and max would ignore a nan.
+double parse_value(std::string_view s)
+{
+   double ret;
+   auto const r = std::from_chars(s.data(), s.data() + std::size(s), ret);
+   if (r.ec != std::errc {} || r.ptr != s.data() + std::size(s) || !std::isfinite(ret))
+      throw std::runtime_error("Invalid value: " + std::string {s});
+
    return ret;
 }
 
-auto make_ranges(range const& r, int col)
+std::vector<aggregate> parse_aggregates(std::string_view s)
 {
-   auto f = [=](auto const& l)
-      { return tsvtree::ssize(l) > col; };
+   std::vector<aggregate> ret;
+   for (auto const name : split_line(s, ',')) {
+      if (name == "sum") ret.push_back(aggregate::sum);
+      else if (name == "min") ret.push_back(aggregate::min);
+      else if (name == "max") ret.push_back(aggregate::max);
+      else if (name == "mean") ret.push_back(aggregate::mean);
+      else throw std::runtime_error("Invalid aggregate: " + std::string {name});
+   }
 
-   auto const first_ok = std::partition(r.begin, r.end, f);
+   if (std::empty(ret))
+      throw std::runtime_error("No aggregate given.");
 
-   std::sort(r.begin, first_ok, line_comp {col});
+   return ret;
+}
+
+void
+write_values(output_sink& os,
+             node_value const& v,
+             std::vector<aggregate> const& aggs,
+             char sep)
+{
+   for (auto a : aggs) {
+      os << sep;
+      switch (a) {
+         case aggregate::sum: os << v.sum; break;
+         case aggregate::min: os << v.min; break;
+         case aggregate::max: os << v.max; break;
+         case aggregate::mean: os << v.sum / v.count; break;
+      }
+   }
+}
 
-   std::deque<range> ret;
-   auto iter = r.begin;
-   while (iter != first_ok) {
-      auto point =
-         std::partition_point(
-            iter,
-            first_ok,
-            line_comp_pred {iter->at(col), col});
+// Length of the longest common prefix of two rows.
+int common_prefix(tsv_row const& a, tsv_row const& b) noexcept
+{
+   auto const n = std::min(a.n, b.n);
+   auto i = 0;
+   while (i < n && a.fields[i] == b.fields[i])
+      ++i;
 
-      ret.push_front({iter, point, col});
-      iter = point;
+   return i;
+}
+
+// Whether each node is the last child of its parent. The nodes of row
+// k begin at depth lcp[k] and are stored from offsets[k] on. Computed
+// backwards, has_next[d] tells whether a sibling of the node at depth
+// d has already been seen.
+auto
+make_lasts(std::vector<tsv_row> const& rows,
+           std::vector<int> const& lcp,
+           std::vector<std::size_t> const& offsets,
+           int max_size)
+{
+   std::vector<char> ret(offsets.back());
+   std::vector<char> has_next(max_size + 1);
+   auto prev = 0;
+   for (auto k = tsvtree::ssize(rows) - 1; k >= 0; --k) {
+      auto const l = lcp[k];
+      auto const n = rows[k].n;
+      if (l == n)
+         continue;
+
+      for (auto d = l; d < n; ++d)
+         ret[offsets[k] + d - l] = !has_next[d];
+
+      // The nodes deeper than l on earlier rows have a different
+      // parent, only entries up to the previous lcp can be set.
+      std::fill(std::begin(has_next) + l + 1,
+                std::begin(has_next) + std::max(l, prev) + 1,
+                0);
+      has_next[l] = 1;
+      prev = l;
    }
 
    return ret;
 }
 
-std::string parse_tree(
-   std::vector<std::vector<std::string>> data,
-   int indent_size,
-   char line_break,
-   char out_field_sep,
-   bool decorate)
+// The aggregates of the values of the rows below each node, indexed
+// as the nodes are written i.e. in pre-order, after the root if it is
+// added. The value of a row is the field after its last one.
+auto
+make_values(std::vector<tsv_row> const& rows,
+            std::vector<int> const& lcp,
+            std::vector<std::size_t> const& offsets,
+            int max_size,
+            int shift)
+{
+   std::vector<node_value> ret(shift + offsets.back());
+
+   // The nodes on the path of the current row.
+   std::vector<std::size_t> path(max_size);
+   for (auto k = 0; k < tsvtree::ssize(rows); ++k) {
+      auto const& row = rows[k];
+      auto const v = parse_value(row.fields[row.n]);
+      for (auto d = lcp[k]; d < row.n; ++d)
+         path[d] = shift + offsets[k] + d - lcp[k];
+
+      if (shift != 0)
+         ret[0].add(v);
+
+      for (auto d = 0; d < row.n; ++d)
+         ret[path[d]].add(v);
+   }
+
+   return ret;
+}
+
+// With root the Root node is written even if the rows have a single
+// first field, which happens when they were filtered, and the values
+// of the rows cut to the Root node are added to its own.
+void parse_tree(
+   std::vector<tsv_row> data,
+   tsv_cfg const& op,
+   output_sink& os,
+   std::vector<node_value>* values,
+   node_value const* root)
 {
    if (std::empty(data))
-      return {};
+      return;
+
+   // After sorting, the nodes of a row that are not on the previous
+   // row are the fields after their longest common prefix.
+   phase_timer sort_phase {"sort"};
+   sort_rows(data, op.threads);
+   sort_phase.add(0, std::size(data));
+   sort_phase.stop();
+
+   phase_timer build_phase {"build"};
+   auto const n = tsvtree::ssize(data);
+   std::vector<int> lcp(n);
+   std::vector<std::size_t> offsets(n + 1);
+   auto max_size = 0;
+   for (auto k = 0; k < n; ++k) {
+      if (k != 0)
+         lcp[k] = common_prefix(data[k - 1], data[k]);
+
+      offsets[k + 1] = offsets[k] + data[k].n - lcp[k];
+      max_size = std::max(max_size, data[k].n);
+   }
 
-   auto begin = std::begin(data);
-   auto end = std::end(data);
+   std::vector<char> node_lasts;
+   if (op.indentation >= 0 && op.decorate)
+      node_lasts = make_lasts(data, lcp, offsets, max_size);
+
+   // There is no root node if the rows have more than one value on
+   // the first column, we have to add it here since we can only parse
+   // trees that have a root node.
+   auto const shift = root || data.front()[0] != data.back()[0] ? 1 : 0;
+
+   std::vector<node_value> node_values;
+   if (!std::empty(op.aggregates))
+      node_values = make_values(data, lcp, offsets, max_size, shift);
+
+   if (root && !std::empty(node_values))
+      node_values[0].add(*root);
+
+   if (stats.enabled()) {
+      std::vector<std::size_t> nodes(max_size + shift);
+      nodes[0] += shift;
+      for (auto k = 0; k < n; ++k)
+         for (auto d = lcp[k]; d < data[k].n; ++d)
+            ++nodes[d + shift];
+      stats.set_nodes_per_depth(std::move(nodes));
+   }
 
-   std::deque<std::deque<range>> st;
-   auto const root_ranges = make_ranges({begin, end, 0}, 0);
-   st.push_back({root_ranges});
+   build_phase.add(0, std::size(data));
+   build_phase.stop();
 
-   std::vector<bool> lasts(1000);
-   lasts[0] = std::size(root_ranges) == 1;
+   // The values are written with the nodes unless the caller wants
+   // them separately.
+   auto const write_values_inline = !std::empty(node_values) && !values;
+   if (values)
+      *values = std::move(node_values);
 
-   std::string ret;
-   auto shift = 0;
-   if (std::size(root_ranges) > 1) {
-      // There is no root node so we have to add it here. We can only
-      // parse trees that have a root node.
-      ret += make_tree_line("Root", 0, indent_size, out_field_sep, lasts, decorate);
-      ret += line_break;
-      ++shift;
-   }
-
-   while (!std::empty(st)) {
-      auto r = st.back().back();
-      st.back().pop_back();
-
-      auto const d = r.depth > 0 && shift == 0 ? 1 : 0;
-      lasts[r.depth - d] = std::empty(st.back());
-
-      if (std::empty(st.back()))
-         st.pop_back();
-
-      ret += make_tree_line(r.begin->at(r.depth),
-                            r.depth + shift,
-                            indent_size,
-                            out_field_sep,
-                            lasts,
-			    decorate);
-      ret += line_break;
-
-      auto const next = r.depth + 1;
-      if (next >= tsvtree::ssize(*r.begin))
+   phase_timer render_phase {"render"};
+   auto const bytes = os.bytes();
+   deco_prefix prefix;
+
+   if (shift != 0) {
+      write_tree_line(os, "Root", 0, op.indentation, op.out_field_sep, {}, op.decorate);
+      if (write_values_inline)
+         write_values(os, node_values[0], op.aggregates, op.out_field_sep);
+      os << op.out_line_break;
+   }
+
+   for (auto k = 0; k < n; ++k) {
+      auto const& row = data[k];
+      for (auto d = lcp[k]; d < row.n; ++d) {
+         auto const depth = d + shift;
+         auto const i = offsets[k] + d - lcp[k];
+         std::string_view deco;
+         if (!std::empty(node_lasts))
+            deco = prefix.next(depth, node_lasts[i]);
+
+         write_tree_line(os,
+                         row[d],
+                         depth,
+                         op.indentation,
+                         op.out_field_sep,
+                         deco,
+                         op.decorate);
+         if (write_values_inline)
+            write_values(os, node_values[shift + i], op.aggregates, op.out_field_sep);
+         os << op.out_line_break;
+      }
+   }
+
+   render_phase.add(os.bytes() - bytes, std::size(data));
+}
+
+// Like parse_tree but builds the tree in a hash_trie instead of
+// sorting the rows.
+void
+write_hash_tree(std::vector<tsv_row> const& data,
+                tsv_cfg const& op,
+                output_sink& os,
+                std::vector<node_value>* values,
+                node_value const* root)
+{
+   if (std::empty(data))
+      return;
+
+   // There are at least as many nodes as distinct rows, the table
+   // grows when there are more.
+   phase_timer build_phase {"build"};
+   hash_trie trie {std::size(data)};
+   auto const aggregate = !std::empty(op.aggregates);
+   std::vector<node_value> node_values(aggregate ? 1 : 0);
+   std::vector<int> path;
+   for (auto const& row : data) {
+      if (!aggregate) {
+         trie.insert({row.fields, row.n});
          continue;
+      }
+
+      auto const added = trie.insert({row.fields, row.n}, &path);
+      node_values.resize(std::size(node_values) + added);
+      auto const v = parse_value(row.fields[row.n]);
+      node_values[hash_trie::head].add(v);
+      for (auto id : path)
+         node_values[id].add(v);
+   }
+
+   if (root && aggregate)
+      node_values[hash_trie::head].add(*root);
+
+   trie.finish(!op.input_order);
+   build_phase.add(0, std::size(data));
+   build_phase.stop();
 
-      st.push_back(std::move(make_ranges(r, next)));
+   // The head is written as the root when there is more than one node
+   // on depth 0. Its aggregates are the ones of all rows.
+   auto const shift = root || tsvtree::ssize(trie.children(hash_trie::head)) > 1 ? 1 : 0;
+
+   auto const write_values_inline = aggregate && !values;
+   if (values) {
+      values->clear();
+      if (aggregate && shift != 0)
+         values->push_back(node_values[hash_trie::head]);
    }
 
-   return ret;
+   phase_timer render_phase {"render"};
+   auto const bytes = os.bytes();
+   auto const count = stats.enabled();
+   std::vector<std::size_t> nodes(shift);
+   deco_prefix prefix;
+
+   if (shift != 0) {
+      write_tree_line(os, "Root", 0, op.indentation, op.out_field_sep, {}, op.decorate);
+      if (write_values_inline)
+         write_values(os, node_values[hash_trie::head], op.aggregates, op.out_field_sep);
+      os << op.out_line_break;
+      if (count)
+         nodes[0] = 1;
+   }
+
+   // The children that are left on each level of the current path.
+   std::vector<std::pair<int const*, int const*>> stack;
+   auto const top = trie.children(hash_trie::head);
+   stack.push_back({top.begin(), top.end()});
+
+   auto const decorate = op.indentation >= 0 && op.decorate;
+   while (!std::empty(stack)) {
+      auto& level = stack.back();
+      if (level.first == level.second) {
+         stack.pop_back();
+         continue;
+      }
+
+      auto const id = *level.first++;
+      auto const last = level.first == level.second;
+      auto const depth = tsvtree::ssize(stack) - 1 + shift;
+
+      std::string_view deco;
+      if (decorate)
+         deco = prefix.next(depth, last);
+
+      write_tree_line(os,
+                      trie.name(id),
+                      depth,
+                      op.indentation,
+                      op.out_field_sep,
+                      deco,
+                      op.decorate);
+      if (write_values_inline)
+         write_values(os, node_values[id], op.aggregates, op.out_field_sep);
+      else if (values && aggregate)
+         values->push_back(node_values[id]);
+      os << op.out_line_break;
+
+      if (count) {
+         nodes.resize(std::max(tsvtree::ssize(nodes), depth + 1));
+         ++nodes[depth];
+      }
+
+      auto const c = trie.children(id);
+      if (!std::empty(c))
+         stack.push_back({c.begin(), c.end()});
+   }
+
+   if (count)
+      stats.set_nodes_per_depth(std::move(nodes));
+
+   render_phase.add(os.bytes() - bytes, trie.size());
 }
 
-std::vector<std::vector<std::string>>
-parse_tsv(std::string const& in, char sep)
+// Rows are recorded as offsets into the fields since that array may
+// still reallocate.
+using row_offsets = std::vector<std::pair<std::size_t, int>>;
+
+void
+tokenize(std::string_view in,
+         char sep,
+         std::vector<std::string_view>& fields,
+         row_offsets& offsets)
 {
-   std::string line;
-   std::istringstream iss(in);
-   std::vector<std::vector<std::string>> ret;
-   while (std::getline(iss, line, '\n')) {
-      auto v = split_line(line, sep);
-      if (!std::empty(v))
-         ret.push_back(std::move(v));
+   delim_scanner scanner {in, sep, '\n'};
+   std::size_t begin = 0;
+   auto row_begin = std::size(fields);
+   for (;;) {
+      auto const p = scanner.next();
+      if (p != begin)
+         fields.push_back(in.substr(begin, p - begin));
+
+      auto const eof = p == std::size(in);
+      if (eof || in[p] == '\n') {
+         auto const n = static_cast<int>(std::size(fields) - row_begin);
+         if (n != 0)
+            offsets.push_back({row_begin, n});
+         row_begin = std::size(fields);
+      }
+
+      if (eof)
+         break;
+
+      begin = p + 1;
    }
+}
 
+// Cuts the input in n chunks of similar size that end on a line break.
+auto make_chunks(std::string_view in, int n)
+{
+   std::vector<std::string_view> ret;
+   std::size_t begin = 0;
+   for (auto i = 1; i < n && begin < std::size(in); ++i) {
+      auto end = std::max(begin, i * (std::size(in) / n));
+      end = in.find('\n', end);
+      if (end == std::string_view::npos)
+         break;
+
+      ret.push_back(in.substr(begin, end + 1 - begin));
+      begin = end + 1;
+   }
+
+   ret.push_back(in.substr(begin));
    return ret;
 }
 
-std::string
-make_tree_string(std::string const& content,
-                 tsv_cfg const& op)
+tsv_table parse_tsv(std::string_view in, char sep, int threads)
 {
-   auto table = parse_tsv(content, op.in_field_sep);
+   auto const chunks = make_chunks(in, std::max(threads, 1));
+   auto const n = tsvtree::ssize(chunks);
+
+   tsv_table ret;
+   ret.fields.resize(n);
+   std::vector<row_offsets> offsets(n);
+
+   std::vector<std::thread> workers;
+   for (auto i = 1; i < n; ++i)
+      workers.emplace_back(tokenize, chunks[i], sep, std::ref(ret.fields[i]), std::ref(offsets[i]));
+
+   tokenize(chunks[0], sep, ret.fields[0], offsets[0]);
+   for (auto& t : workers)
+      t.join();
+
+   std::size_t rows = 0;
+   for (auto const& o : offsets)
+      rows += std::size(o);
+
+   ret.rows.reserve(rows);
+   for (auto i = 0; i < n; ++i)
+      for (auto const& o : offsets[i])
+         ret.rows.push_back({ret.fields[i].data() + o.first, o.second});
+
+   return ret;
+}
+
+int row_prefix::next(array_view<std::string_view const> row)
+{
+   auto const n = std::min(tsvtree::ssize(prev_), tsvtree::ssize(row));
+   auto lcp = 0;
+   while (lcp < n && prev_[lcp] == row[lcp])
+      ++lcp;
+
+   if (lcp < n && row[lcp] < prev_[lcp])
+      return -1;
+
+   prev_.resize(std::size(row));
+   for (auto i = lcp; i < tsvtree::ssize(row); ++i)
+      prev_[i].assign(row[i]);
+
+   return lcp;
+}
 
-   return parse_tree(std::move(table),
-                     op.indentation,
-                     op.out_line_break,
-                     op.out_field_sep,
-		     op.decorate);
+sorted_tree_writer::sorted_tree_writer(tsv_cfg const& op, output_sink& os)
+: op_ {op}
+, os_ {&os}
+, count_ {stats.enabled()}
+{ }
+
+sorted_tree_writer::~sorted_tree_writer()
+{
+   if (count_)
+      stats.set_nodes_per_depth(std::move(nodes_));
+}
+
+void sorted_tree_writer::write_root()
+{
+   write_tree_line(*os_, "Root", 0, op_.indentation, op_.out_field_sep, {}, op_.decorate);
+   *os_ << op_.out_line_break;
+   shift_ = 1;
+   if (count_)
+      nodes_.push_back(1);
+}
+
+void
+sorted_tree_writer::write(array_view<std::string_view const> row,
+                          int lcp,
+                          char const* lasts)
+{
+   auto const n = tsvtree::ssize(row);
+   auto const decorate = op_.indentation >= 0 && op_.decorate;
+   assert(!decorate || lasts || lcp == n);
+
+   for (auto i = lcp; i < n; ++i) {
+      std::string_view deco;
+      if (decorate)
+         deco = prefix_.next(i + shift_, lasts[i - lcp]);
+
+      write_tree_line(*os_,
+                      row[i],
+                      i + shift_,
+                      op_.indentation,
+                      op_.out_field_sep,
+                      deco,
+                      op_.decorate);
+      *os_ << op_.out_line_break;
+   }
+
+   if (count_) {
+      nodes_.resize(std::max(tsvtree::ssize(nodes_), n + shift_));
+      for (auto i = lcp; i < n; ++i)
+         ++nodes_[i + shift_];
+   }
+}
+
+void
+write_sorted_tree(std::string const& file,
+                  tsv_cfg const& op,
+                  output_sink& os,
+                  sorted_root root)
+{
+   // The nodes are emitted as soon as they are seen, which is only
+   // possible if the lastness of a node is not needed.
+   assert(op.indentation < 0 || !op.decorate);
+
+   phase_timer phase {"stream"};
+   auto const bytes = os.bytes();
+   std::size_t rows = 0;
+
+   line_reader reader {file};
+
+   // The root node has to be added if the rows have more than one
+   // value on the first column. For sorted input this is the case when
+   // the first and the last rows differ there, which can't be known
+   // before writing the tree of a pipe.
+   std::vector<std::string_view> row;
+   std::string last;
+   std::string last_first;
+   if (root == sorted_root::automatic) {
+      if (!reader.last_line(last, '\n'))
+         throw std::runtime_error("Sorted input read from a pipe needs --root always or never.");
+
+      split_line(last, op.in_field_sep, row);
+      if (!std::empty(row))
+         last_first = row.front();
+   }
+
+   sorted_tree_writer writer {op, os};
+   row_prefix prefix;
+   auto has_root = false;
+   std::string_view line;
+   while (reader.next(line, '\n')) {
+      split_line(line, op.in_field_sep, row);
+      if (std::empty(row))
+         continue;
+
+      if (rows++ == 0) {
+         has_root = root == sorted_root::always
+                 || (root == sorted_root::automatic && row.front() != last_first);
+         if (has_root)
+            writer.write_root();
+      }
+
+      // Only the nodes after the common prefix with the previous row
+      // are new.
+      auto const lcp = prefix.next(row);
+      if (lcp == -1)
+         throw std::runtime_error("Input is not sorted: " + std::string {line});
+
+      if (rows != 1 && lcp == 0 && !has_root)
+         throw std::runtime_error("Sorted input has more than one root, see --root.");
+
+      writer.write(row, lcp);
+   }
+
+   phase.add(os.bytes() - bytes, rows);
+}
+
+void
+write_tree(std::string_view content,
+           tsv_cfg const& op,
+           output_sink& os,
+           std::vector<node_value>* values)
+{
+   phase_timer tokenize_phase {"tokenize"};
+   auto table = parse_tsv(content, op.in_field_sep, op.threads);
+   tokenize_phase.add(std::size(content), std::size(table.rows));
+   tokenize_phase.stop();
+
+   // The value is left after the last field of the row, where it is
+   // still found after sorting.
+   if (!std::empty(op.aggregates)) {
+      for (auto& row : table.rows) {
+         if (row.n < 2)
+            throw std::runtime_error("Row without value: " + std::string {row[0]});
+         --row.n;
+      }
+   }
+
+   // The rows that are not selected are dropped before they are
+   // sorted. The value of a row belongs to its last node, so a row cut
+   // by an exclusion is dropped too, as is one that does not match.
+   // The paths begin with Root when the input needs it, as they do
+   // when the output is filtered as tree input, and it is then kept
+   // even if the rows left have a single first field.
+   auto root = false;
+   auto root_selected = false;
+   node_value root_value;
+   if (!op.filter.empty()) {
+      phase_timer filter_phase {"filter"};
+      auto& rows = table.rows;
+      auto const n = std::size(rows);
+      root = std::any_of(std::begin(rows), std::end(rows),
+         [&](auto const& row) { return row[0] != rows.front()[0]; });
+
+      auto const s = op.filter.next(op.filter.start(), "Root");
+      root_selected = root && !op.filter.pruned(s) && op.filter.selected(s);
+
+      auto const values = !std::empty(op.aggregates);
+      auto const end = std::remove_if(std::begin(rows), std::end(rows), [&](auto& row) {
+         auto excluded = false;
+         auto const k = op.filter.keep({row.fields, row.n}, root, &excluded);
+         if (values && excluded)
+            return true;
+         if (values && k == 0 && root_selected)
+            root_value.add(parse_value(row.fields[row.n]));
+         if (values)
+            row.fields[k] = row.fields[row.n];
+         row.n = k;
+         return k == 0;
+      });
+
+      rows.erase(end, std::end(rows));
+      filter_phase.add(0, n);
+   }
+
+   // Only the Root node is selected.
+   if (root_selected && std::empty(table.rows)) {
+      write_tree_line(os, "Root", 0, op.indentation, op.out_field_sep, {}, op.decorate);
+      if (values)
+         values->assign(1, root_value);
+      else if (!std::empty(op.aggregates))
+         write_values(os, root_value, op.aggregates, op.out_field_sep);
+      os << op.out_line_break;
+      return;
+   }
+
+   auto const* root_values = root ? &root_value : nullptr;
+   if (op.hash)
+      write_hash_tree(table.rows, op, os, values, root_values);
+   else
+      parse_tree(std::move(table.rows), op, os, values, root_values);
+}
+
+std::string
+make_tree_string(std::string_view content,
+                 tsv_cfg const& op,
+                 std::vector<node_value>* values)
+{
+   std::string ret;
+   string_sink os {ret};
+   write_tree(content, op, os, values);
+   os.flush();
+   return ret;
 }
 }
 
@@ -18,22 +18,209 @@
 
 #pragma once
 
+#include <cmath>
+#include <vector>
 #include <string>
+#include <limits>
+#include <cstdint>
+#include <algorithm>
+#include <stdexcept>
+#include <string_view>
+
+#include "utils.hpp"
+#include "pattern.hpp"
 
 namespace tsvtree
 {
 
+class output_sink;
+
+// A row of a tsv_table, the fields are views into the input data.
+struct tsv_row {
+   std::string_view* fields = nullptr;
+   int n = 0;
+
+   auto size() const noexcept { return n; }
+   auto const& operator[](int i) const noexcept { return fields[i]; }
+   auto const& at(int i) const
+   {
+      if (i < 0 || i >= n)
+         throw std::out_of_range("tsv_row::at");
+      return fields[i];
+   }
+};
+
+// The tokenized content of a tsv file. The fields live in one array
+// per chunk of the input so that tokenizing does not allocate per
+// field or per row.
+struct tsv_table {
+   std::vector<std::vector<std::string_view>> fields;
+   std::vector<tsv_row> rows;
+};
+
+// Tokenizes the input. With more than one thread the input is cut
+// into chunks at line boundaries that are tokenized in parallel.
+tsv_table parse_tsv(std::string_view in, char sep, int threads = 1);
+
+// Sorts the rows lexicographically. With more than one thread a
+// parallel merge sort is used.
+void sort_rows(std::vector<tsv_row>& rows, int threads = 1);
+
+// Writes one node of the tree output, without line break. With a
+// negative indentation as depth and name (comp), otherwise indented
+// with the decoration, if any, or tabs.
+void
+write_tree_line(output_sink& os,
+                std::string_view name,
+                int depth,
+                int indent_size,
+                char out_field_sep,
+                std::string_view deco,
+                bool decorate);
+
+// The aggregates of the value column that can be reported.
+enum class aggregate {sum, min, max, mean};
+
+// Aggregates of the value column over the rows below a node.
+struct node_value {
+   double sum = 0;
+   double min = std::numeric_limits<double>::infinity();
+   double max = -std::numeric_limits<double>::infinity();
+   std::int64_t count = 0;
+
+   void add(double v)
+   {
+      sum += v;
+      min = std::min(min, v);
+      max = std::max(max, v);
+      ++count;
+      check();
+   }
+
+   void add(node_value const& v)
+   {
+      sum += v.sum;
+      min = std::min(min, v.min);
+      max = std::max(max, v.max);
+      count += v.count;
+      check();
+   }
+
+   // The values are finite, see parse_value, but not necessarily their
+   // sum.
+   void check() const
+   {
+      if (!std::isfinite(sum))
+         throw std::runtime_error("The sum of the values is out of range.");
+   }
+};
+
+// Parses a list of aggregates e.g. "sum,max".
+std::vector<aggregate> parse_aggregates(std::string_view s);
+
+// Writes the aggregates of a node, each one preceded by sep.
+void
+write_values(output_sink& os,
+             node_value const& v,
+             std::vector<aggregate> const& aggs,
+             char sep);
+
 struct tsv_cfg {
    int indentation;
    char in_field_sep = ':';
    char out_field_sep = ';';
    char out_line_break = '\n';
    bool decorate = true;
+   int threads = 1;
+
+   // When not empty the last field of each row is a number that is
+   // aggregated over the nodes of the row instead of being a node.
+   std::vector<aggregate> aggregates;
+
+   // The rows are cut after their last selected node, see path_filter.
+   path_filter filter;
+
+   // Builds the tree in a hash_trie instead of sorting the rows. The
+   // children are then sorted at the end, unless input_order is set,
+   // in which case they are in the order they first appear.
+   bool hash = false;
+   bool input_order = false;
 };
 
+// Writes the tree of a tsv file, the rows are sorted first. The
+// aggregates of the value column, if any, follow the node names
+// unless values is given, where they are then returned in the order
+// of the nodes.
+void
+write_tree(std::string_view content,
+           tsv_cfg const& op,
+           output_sink& os,
+           std::vector<node_value>* values = nullptr);
+
+// Like write_tree but returns the tree as a string, to be parsed
+// again.
 std::string
-make_tree_string(std::string const& content,
-                 tsv_cfg const& op);
+make_tree_string(std::string_view content,
+                 tsv_cfg const& op,
+                 std::vector<node_value>* values = nullptr);
+
+// The longest common prefix of each row with the previous one, for
+// sorted rows that come one at a time. A copy of the previous row is
+// kept.
+class row_prefix {
+private:
+   std::vector<std::string> prev_;
+
+public:
+   // Returns the prefix length, i.e. the depth of the first node of
+   // the row that is not on the previous one, or -1 if the row comes
+   // before the previous one.
+   int next(array_view<std::string_view const> row);
+};
+
+// Writes the tree of sorted rows as they come. The decorated output
+// needs to know whether each node is the last child of its parent,
+// which has to be computed beforehand, see write_tree_external.
+class sorted_tree_writer {
+private:
+   tsv_cfg op_;
+   output_sink* os_;
+   deco_prefix prefix_;
+   int shift_ = 0;
+   bool count_;
+   std::vector<std::size_t> nodes_;
+
+public:
+   sorted_tree_writer(sorted_tree_writer const&) = delete;
+   sorted_tree_writer& operator=(sorted_tree_writer const&) = delete;
+   sorted_tree_writer(tsv_cfg const& op, output_sink& os);
+   ~sorted_tree_writer();
+
+   // Adds a root node, to be called before the first row if the rows
+   // have more than one value in the first field.
+   void write_root();
+
+   // Writes the nodes of the row from depth lcp on. When decorated,
+   // lasts has whether each of them is the last child.
+   void write(array_view<std::string_view const> row,
+              int lcp,
+              char const* lasts = nullptr);
+};
+
+// Whether write_sorted_tree adds the Root node above the rows.
+// Automatic compares the first field of the first and last rows, which
+// requires a file.
+enum class sorted_root { automatic, always, never };
+
+// Writes the tree of a tsv file whose rows are already sorted. Nodes
+// are written as soon as they are read, keeping only the previous row
+// in memory. Decorated output is not supported since it requires
+// knowing whether a node is the last child.
+void
+write_sorted_tree(std::string const& file,
+                  tsv_cfg const& op,
+                  output_sink& os,
+                  sorted_root root = sorted_root::automatic);
 
 }
 
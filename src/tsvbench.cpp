@@ -0,0 +1,299 @@
+/* Copyright (c) 2020 - 2021 Marcelo Zimbres Silva (mzimbres at gmail dot com)
+ *
+ * This file is part of tsvtree.
+ *
+ * tsvtree is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tsvtree is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tsvtree.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Measures the stages of tsvtree separately on tsv files, normally the
+// ones generated by tsvsim in bench.sh. Every stage is run a number of
+// times and the fastest run is reported, with the throughput relative
+// to the size and rows of the tsv file, so that the stages can be
+// compared with each other and between releases.
+//
+//    tsvbench [--json] [--repeat N] [--threads N] file...
+
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+#include <sys/resource.h>
+
+#include "tsv.hpp"
+#include "scan.hpp"
+#include "input.hpp"
+#include "output.hpp"
+#include "flat_tree.hpp"
+#include "tree_utils.hpp"
+
+namespace tsvtree {
+
+// Discards the output, only its size is kept.
+class null_sink : public output_sink {
+private:
+   std::size_t bytes_ = 0;
+
+protected:
+   void write_all(char const*, std::size_t n) override { bytes_ += n; }
+
+public:
+   ~null_sink() { flush(); }
+   auto bytes() const noexcept { return bytes_; }
+};
+
+// Resets the peak resident set size of the process. Supported since
+// Linux 4.0, elsewhere the peak of the whole run is reported.
+void reset_peak_rss()
+{
+   std::ofstream f {"/proc/self/clear_refs"};
+   f << "5";
+}
+
+long peak_rss_kb()
+{
+   std::ifstream f {"/proc/self/status"};
+   std::string line;
+   while (std::getline(f, line))
+      if (line.compare(0, 6, "VmHWM:") == 0)
+         return std::stol(line.substr(6));
+
+   rusage ru {};
+   ::getrusage(RUSAGE_SELF, &ru);
+   return ru.ru_maxrss;
+}
+
+struct bench_cfg {
+   bool json = false;
+   int repeat = 3;
+   int threads = 1;
+};
+
+class bench {
+private:
+   bench_cfg cfg_;
+   std::string dataset_;
+   std::size_t bytes_ = 0;
+   std::size_t rows_ = 0;
+
+   void report(std::string const& stage, double seconds, long rss) const
+   {
+      auto const mb_per_s = bytes_ / seconds / 1e6;
+      auto const rows_per_s = rows_ / seconds;
+
+      if (cfg_.json) {
+         std::cout
+            << "{\"dataset\": \"" << dataset_ << "\""
+            << ", \"stage\": \"" << stage << "\""
+            << ", \"threads\": " << cfg_.threads
+            << ", \"scanner\": \"" << scanner_impl() << "\""
+            << ", \"seconds\": " << seconds
+            << ", \"bytes\": " << bytes_
+            << ", \"rows\": " << rows_
+            << ", \"mb_per_s\": " << mb_per_s
+            << ", \"rows_per_s\": " << rows_per_s
+            << ", \"peak_rss_kb\": " << rss
+            << "}\n";
+         return;
+      }
+
+      std::cout
+         << dataset_ << '\t'
+         << stage << '\t'
+         << cfg_.threads << '\t'
+         << scanner_impl() << '\t'
+         << seconds << '\t'
+         << bytes_ << '\t'
+         << rows_ << '\t'
+         << mb_per_s << '\t'
+         << rows_per_s << '\t'
+         << rss << '\n';
+   }
+
+public:
+   explicit bench(bench_cfg const& cfg) : cfg_ {cfg} { }
+
+   void header() const
+   {
+      if (!cfg_.json)
+         std::cout << "dataset\tstage\tthreads\tscanner\tseconds\tbytes\trows\tmb_per_s\trows_per_s\tpeak_rss_kb\n";
+   }
+
+   void set_dataset(std::string name, std::size_t bytes, std::size_t rows)
+   {
+      dataset_ = std::move(name);
+      bytes_ = bytes;
+      rows_ = rows;
+   }
+
+   // Runs f the configured number of times, prepare is called before
+   // each run and is not measured.
+   template <class Prepare, class F>
+   void run(std::string const& stage, Prepare prepare, F f)
+   {
+      using clock_type = std::chrono::steady_clock;
+
+      reset_peak_rss();
+      auto best = std::numeric_limits<double>::infinity();
+      for (auto i = 0; i < cfg_.repeat; ++i) {
+         prepare();
+         auto const begin = clock_type::now();
+         f();
+         std::chrono::duration<double> const d = clock_type::now() - begin;
+         best = std::min(best, d.count());
+      }
+
+      report(stage, best, peak_rss_kb());
+   }
+
+   template <class F>
+   void run(std::string const& stage, F f)
+      { run(stage, []{}, f); }
+};
+
+auto dataset_name(std::string const& file)
+{
+   auto const b = file.find_last_of('/');
+   auto name = file.substr(b == std::string::npos ? 0 : b + 1);
+   auto const e = name.find_last_of('.');
+   return e == std::string::npos ? name : name.substr(0, e);
+}
+
+void run_dataset(bench& b, std::string const& file, bench_cfg const& cfg)
+{
+   // The file is copied so that page faults on the mapping are not
+   // attributed to the first stage.
+   std::string content;
+   {
+      input_buffer const in {file};
+      content = in.view();
+   }
+
+   auto const rows = std::size(parse_tsv(content, '\t').rows);
+   b.set_dataset(dataset_name(file), std::size(content), rows);
+
+   b.run("tokenize", [&] { parse_tsv(content, '\t', cfg.threads); });
+
+   auto const table = parse_tsv(content, '\t', cfg.threads);
+   std::vector<tsv_row> sorted;
+   b.run("sort",
+         [&] { sorted = table.rows; },
+         [&] { sort_rows(sorted, cfg.threads); });
+
+   tsv_cfg comp_cfg;
+   comp_cfg.indentation = -1;
+   comp_cfg.in_field_sep = '\t';
+   comp_cfg.out_field_sep = '\t';
+   comp_cfg.decorate = false;
+   comp_cfg.threads = cfg.threads;
+
+   auto tab_cfg = comp_cfg;
+   tab_cfg.indentation = 0;
+
+   auto deco_cfg = tab_cfg;
+   deco_cfg.decorate = true;
+
+   b.run("build_comp", [&] { null_sink os; write_tree(content, comp_cfg, os); });
+   b.run("build_tree", [&] { null_sink os; write_tree(content, tab_cfg, os); });
+   b.run("build_tree_deco", [&] { null_sink os; write_tree(content, deco_cfg, os); });
+
+   auto hash_cfg = comp_cfg;
+   hash_cfg.hash = true;
+   b.run("build_comp_hash", [&] { null_sink os; write_tree(content, hash_cfg, os); });
+
+   auto const comp = make_tree_string(content, comp_cfg);
+   auto const tab = make_tree_string(content, tab_cfg);
+   oconfig const comp_in {'\t', '\n', oconfig::format::comp, {}};
+   oconfig const tab_in {'\t', '\n', oconfig::format::tree, {}};
+
+   b.run("parse_comp", [&] { flat_tree t {comp, comp_in}; });
+   b.run("parse_tree", [&] { flat_tree t {tab, tab_in}; });
+
+   std::unique_ptr<flat_tree> t;
+   b.run("leaf_counters",
+         [&] { t = std::make_unique<flat_tree>(comp, comp_in); },
+         [&] { t->load_leaf_counters(cfg.threads); });
+
+   auto const serialize_to_null = [&](oconfig::format of) {
+      null_sink os;
+      serialize(*t, 0, of, '\n', std::numeric_limits<int>::max(), '\t', os);
+   };
+
+   b.run("serialize_comp", [&] { serialize_to_null(oconfig::format::comp); });
+   b.run("serialize_tree", [&] { serialize_to_null(oconfig::format::tree); });
+   b.run("serialize_tree_deco", [&] { serialize_to_null(oconfig::format::tree_deco); });
+   b.run("serialize_tikz", [&] { serialize_to_null(oconfig::format::tikz); });
+
+   b.run("expand_tsv", [&] {
+      null_sink os;
+      write_leaf_paths(*t, 0, std::numeric_limits<int>::max(), '\t', os);
+   });
+
+   std::string bin;
+   b.run("write_bin",
+         [&] { bin.clear(); },
+         [&] { string_sink os {bin}; write_binary(*t, os); });
+
+   oconfig const bin_in {'\t', '\n', oconfig::format::bin, {}};
+   b.run("load_bin", [&] { flat_tree m {bin, bin_in}; });
+
+   std::string comp_bin;
+   b.run("write_comp_bin",
+         [&] { comp_bin.clear(); },
+         [&] { string_sink os {comp_bin}; write_comp_binary(*t, os, true); });
+
+   oconfig const comp_bin_in {'\t', '\n', oconfig::format::comp_bin, {}};
+   b.run("load_comp_bin", [&] { flat_tree m {comp_bin, comp_bin_in}; });
+}
+
+} // tsvtree
+
+using namespace tsvtree;
+
+int main(int argc, char* argv[])
+{
+   try {
+      bench_cfg cfg;
+      std::vector<std::string> files;
+      for (auto i = 1; i < argc; ++i) {
+         std::string const arg = argv[i];
+         if (arg == "--json") {
+            cfg.json = true;
+         } else if (arg == "--repeat" && i + 1 < argc) {
+            cfg.repeat = std::max(1, parse_number<int>("--repeat", argv[++i]));
+         } else if (arg == "--threads" && i + 1 < argc) {
+            cfg.threads = std::max(1, parse_number<int>("--threads", argv[++i]));
+         } else {
+            files.push_back(arg);
+         }
+      }
+
+      if (std::empty(files)) {
+         std::cerr << "Usage: tsvbench [--json] [--repeat N] [--threads N] file..." << std::endl;
+         return 1;
+      }
+
+      bench b {cfg};
+      b.header();
+      for (auto const& file : files)
+         run_dataset(b, file, cfg);
+   } catch (std::exception const& e) {
+      std::cerr << e.what() << std::endl;
+      return 1;
+   }
+}
@@ -16,8 +16,44 @@
  * along with tsvtree.  If not, see <https://www.gnu.org/licenses/>.
  */
 
-#include <iostream>
+#include <string>
+#include <vector>
 #include <random>
+#include <cmath>
+#include <cstdint>
+#include <numeric>
+#include <iostream>
+#include <algorithm>
+#include <stdexcept>
+
+#include <getopt.h>
+#include <unistd.h>
+
+#include "utils.hpp"
+#include "output.hpp"
+
+using namespace tsvtree;
+
+char const* usage =
+"Usage: tsvsim [options] [rows [depth [word-length [seed]]]]\n"
+"\n"
+"Writes random tsv data to stdout. Without options each row has depth\n"
+"fields made of word-length random letters. The options select a\n"
+"generator where each field is a child of the previous one:\n"
+"\n"
+"  -n, --rows=N         Number of rows.\n"
+"  -d, --depth=N        Maximum number of fields in a row.\n"
+"  -m, --min-depth=N    Minimum number of fields in a row, the number\n"
+"                       of fields is uniform in [min-depth, depth].\n"
+"  -f, --fanout=LIST    Children of each node per level, e.g. 10,100,5.\n"
+"                       The last value is used for the deeper levels.\n"
+"  -z, --zipf=S         Children are chosen with probability proportional\n"
+"                       to 1/k^S where k is their rank, 0 is uniform.\n"
+"  -l, --name-length=N  Number of characters in the names.\n"
+"  -u, --utf8           Use non-ASCII characters in the names.\n"
+"  -s, --sorted         Write the rows sorted, as LC_ALL=C sort would.\n"
+"  -r, --seed=N         Seed of the random generator.\n"
+"  -h, --help           This help message.\n";
 
 template <class R>
 auto make_random_text(R r, int size)
@@ -27,18 +63,9 @@ auto make_random_text(R r, int size)
    return s;
 }
 
-int main(int argc, char* argv[])
+// The original generator, kept so that its output does not change.
+void write_words(output_sink& os, long lines, int depth, int word_length, unsigned seed)
 {
-   int lines = 10;
-   int depth = 10;
-   int word_length = 4;
-   int seed = 1;
-
-   if (argc > 1) lines = std::stoi(argv[1]);
-   if (argc > 2) depth = std::stoi(argv[2]);
-   if (argc > 3) word_length = std::stoi(argv[3]);
-   if (argc > 4) seed = std::stoi(argv[4]);
-
    std::mt19937 gen(seed);
 
    std::uniform_int_distribution<int> words_dis('a', 'a' + word_length);
@@ -47,7 +74,302 @@ int main(int argc, char* argv[])
 
    for (auto i = 0; i < lines; ++i) {
       for (auto i = 0; i < depth; ++i)
-         std::cout << make_random_text(g, word_length) << '\t';
-      std::cout << '\n';
+         os << make_random_text(g, word_length) << '\t';
+      os << '\n';
+   }
+}
+
+struct sim_cfg {
+   long rows = 10;
+   int depth = 10;
+   int min_depth = -1;
+   std::vector<int> fanout {10};
+   double zipf = 0;
+   int name_length = 8;
+   bool utf8 = false;
+   bool sorted = false;
+   unsigned seed = 1;
+};
+
+auto splitmix64(std::uint64_t x)
+{
+   x += 0x9e3779b97f4a7c15;
+   x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9;
+   x = (x ^ (x >> 27)) * 0x94d049bb133111eb;
+   return x ^ (x >> 31);
+}
+
+// The possible children of the nodes of one level. The names depend
+// only on the level and the position so that the same child is shared
+// by all rows that choose it.
+struct level {
+   std::vector<std::string> names;
+   std::vector<double> probs;
+   std::discrete_distribution<int> dist;
+
+   // The children in the order of their names.
+   std::vector<int> order;
+   std::vector<int> rank;
+};
+
+auto make_name(sim_cfg const& cfg, int lvl, int i, int width)
+{
+   static char const* const letters[] =
+   {"á", "ç", "é", "ñ", "ø", "ü", "ß", "λ", "ж", "中", "語", "ö"};
+
+   // The name ends with the position of the child in base 26, which
+   // makes it unique, and starts with random characters.
+   auto h = splitmix64(cfg.seed ^ (std::uint64_t(lvl) << 32) ^ std::uint64_t(i));
+   std::string ret;
+   for (auto k = width; k < cfg.name_length; ++k) {
+      h = splitmix64(h);
+      if (cfg.utf8)
+         ret += letters[h % std::size(letters)];
+      else
+         ret += static_cast<char>('a' + h % 26);
+   }
+
+   std::string code(width, 'a');
+   for (auto k = width - 1; k >= 0; --k, i /= 26)
+      code[k] = static_cast<char>('a' + i % 26);
+
+   return ret + code;
+}
+
+auto make_level(sim_cfg const& cfg, int lvl)
+{
+   auto const n = cfg.fanout[std::min(lvl, static_cast<int>(std::size(cfg.fanout)) - 1)];
+
+   auto width = 1;
+   for (auto m = n - 1; m >= 26; m /= 26)
+      ++width;
+
+   level ret;
+   for (auto i = 0; i < n; ++i) {
+      ret.names.push_back(make_name(cfg, lvl, i, width));
+      ret.probs.push_back(1.0 / std::pow(i + 1.0, cfg.zipf));
+   }
+
+   auto const sum = std::accumulate(std::begin(ret.probs), std::end(ret.probs), 0.0);
+   for (auto& p : ret.probs)
+      p /= sum;
+
+   ret.dist = {std::begin(ret.probs), std::end(ret.probs)};
+
+   ret.order.resize(n);
+   std::iota(std::begin(ret.order), std::end(ret.order), 0);
+   std::sort(std::begin(ret.order), std::end(ret.order), [&](auto a, auto b)
+      { return ret.names[a] < ret.names[b]; });
+
+   ret.rank.resize(n);
+   for (auto r = 0; r < n; ++r)
+      ret.rank[ret.order[r]] = r;
+
+   return ret;
+}
+
+class simulator {
+private:
+   sim_cfg cfg_;
+   std::vector<level> levels_;
+   std::mt19937_64 gen_;
+   output_sink& os_;
+
+   // The fields of the current row.
+   std::string line_;
+
+   int row_depth()
+   {
+      std::uniform_int_distribution<int> d {cfg_.min_depth, cfg_.depth};
+      return d(gen_);
+   }
+
+   // Splits n rows among the children of a node in the order of
+   // their names. The counts are multinomial.
+   void split(int lvl, long n, std::vector<std::pair<int, long>>& out)
+   {
+      auto& l = levels_[lvl];
+      auto const fanout = static_cast<long>(std::size(l.names));
+      out.clear();
+
+      if (n < fanout) {
+         // Cheaper to draw the rows one by one.
+         std::vector<int> ranks;
+         for (auto i = 0; i < n; ++i)
+            ranks.push_back(l.rank[l.dist(gen_)]);
+
+         std::sort(std::begin(ranks), std::end(ranks));
+         for (auto r : ranks) {
+            if (!std::empty(out) && out.back().first == r)
+               ++out.back().second;
+            else
+               out.push_back({r, 1});
+         }
+
+         return;
+      }
+
+      auto mass = 1.0;
+      for (auto r = 0; r < fanout && n > 0; ++r) {
+         auto const p = l.probs[l.order[r]];
+         long c = n;
+         if (r != fanout - 1 && p < mass) {
+            std::binomial_distribution<long> b {n, std::min(1.0, p / mass)};
+            c = b(gen_);
+         }
+
+         if (c != 0)
+            out.push_back({r, c});
+
+         n -= c;
+         mass -= p;
+      }
+   }
+
+   // Writes n rows below the current line.
+   void write_sorted(int lvl, long n)
+   {
+      if (lvl >= cfg_.min_depth) {
+         // The rows that end here come first.
+         auto end = n;
+         if (lvl < cfg_.depth) {
+            std::binomial_distribution<long> b {n, 1.0 / (cfg_.depth - lvl + 1)};
+            end = b(gen_);
+         }
+
+         for (auto i = 0; i < end; ++i)
+            os_ << line_ << '\n';
+
+         n -= end;
+      }
+
+      if (n == 0)
+         return;
+
+      std::vector<std::pair<int, long>> children;
+      split(lvl, n, children);
+
+      auto const size = std::size(line_);
+      for (auto const& c : children) {
+         if (lvl != 0)
+            line_ += '\t';
+         line_ += levels_[lvl].names[levels_[lvl].order[c.first]];
+         write_sorted(lvl + 1, c.second);
+         line_.resize(size);
+      }
+   }
+
+public:
+   simulator(sim_cfg const& cfg, output_sink& os)
+   : cfg_ {cfg}
+   , gen_ {cfg.seed}
+   , os_ {os}
+   {
+      for (auto i = 0; i < cfg_.depth; ++i)
+         levels_.push_back(make_level(cfg_, i));
+   }
+
+   void run()
+   {
+      if (cfg_.sorted) {
+         write_sorted(0, cfg_.rows);
+         return;
+      }
+
+      // Rows drawn independently are in random order.
+      for (auto i = 0; i < cfg_.rows; ++i) {
+         auto const d = row_depth();
+         for (auto k = 0; k < d; ++k) {
+            if (k != 0)
+               os_ << '\t';
+            os_ << levels_[k].names[levels_[k].dist(gen_)];
+         }
+         os_ << '\n';
+      }
+   }
+};
+
+auto parse_fanout(std::string const& s)
+{
+   std::vector<int> ret;
+   std::size_t pos = 0;
+   while (pos <= std::size(s)) {
+      auto const end = std::min(s.find(',', pos), std::size(s));
+      auto const n = parse_number<int>("--fanout", s.substr(pos, end - pos));
+      if (n <= 0)
+         throw std::runtime_error("Invalid fanout.");
+
+      ret.push_back(n);
+      pos = end + 1;
+   }
+
+   return ret;
+}
+
+int main(int argc, char* argv[])
+{
+   try {
+      sim_cfg cfg;
+      auto options = false;
+
+      option const long_options[] =
+      { {"rows",        required_argument, nullptr, 'n'}
+      , {"depth",       required_argument, nullptr, 'd'}
+      , {"min-depth",   required_argument, nullptr, 'm'}
+      , {"fanout",      required_argument, nullptr, 'f'}
+      , {"zipf",        required_argument, nullptr, 'z'}
+      , {"name-length", required_argument, nullptr, 'l'}
+      , {"utf8",        no_argument,       nullptr, 'u'}
+      , {"sorted",      no_argument,       nullptr, 's'}
+      , {"seed",        required_argument, nullptr, 'r'}
+      , {"help",        no_argument,       nullptr, 'h'}
+      , {nullptr,       0,                 nullptr, 0}
+      };
+
+      int c;
+      while ((c = getopt_long(argc, argv, "n:d:m:f:z:l:usr:h", long_options, nullptr)) != -1) {
+         options = true;
+         switch (c) {
+            case 'n': cfg.rows = parse_number<long>("--rows", optarg); break;
+            case 'd': cfg.depth = parse_number<int>("--depth", optarg); break;
+            case 'm': cfg.min_depth = parse_number<int>("--min-depth", optarg); break;
+            case 'f': cfg.fanout = parse_fanout(optarg); break;
+            case 'z': cfg.zipf = parse_number<double>("--zipf", optarg); break;
+            case 'l': cfg.name_length = parse_number<int>("--name-length", optarg); break;
+            case 'u': cfg.utf8 = true; break;
+            case 's': cfg.sorted = true; break;
+            case 'r': cfg.seed = parse_number<unsigned>("--seed", optarg); break;
+            case 'h': std::cout << usage; return 0;
+            default: std::cerr << usage; return 1;
+         }
+      }
+
+      // The positional arguments of the original generator.
+      auto word_length = 4;
+      auto const args = argc - optind;
+      if (args > 0) cfg.rows = parse_number<long>("rows", argv[optind]);
+      if (args > 1) cfg.depth = parse_number<int>("depth", argv[optind + 1]);
+      if (args > 2) word_length = parse_number<int>("word-length", argv[optind + 2]);
+      if (args > 3) cfg.seed = parse_number<unsigned>("seed", argv[optind + 3]);
+
+      fd_sink os {STDOUT_FILENO};
+      if (!options) {
+         write_words(os, cfg.rows, cfg.depth, word_length, cfg.seed);
+         os.flush();
+         return 0;
+      }
+
+      if (cfg.min_depth < 0)
+         cfg.min_depth = cfg.depth;
+
+      if (cfg.depth < 1 || cfg.min_depth < 1 || cfg.min_depth > cfg.depth)
+         throw std::runtime_error("Invalid depth.");
+
+      simulator sim {cfg, os};
+      sim.run();
+      os.flush();
+   } catch (std::exception const& e) {
+      std::cerr << e.what() << std::endl;
+      return 1;
    }
 }
@@ -18,10 +18,16 @@
 
 #include <stack>
 #include <string>
+#include <limits>
+#include <charconv>
+#include <string_view>
 #include <sstream>
 #include <iostream>
-#include <fstream>
+#include <thread>
 #include <iterator>
+#include <algorithm>
+
+#include <unistd.h>
 
 #include <boost/program_options/options_description.hpp>
 #include <boost/program_options/parsers.hpp>
@@ -29,6 +35,12 @@
 
 #include "tsv.hpp"
 #include "tree.hpp"
+#include "input.hpp"
+#include "output.hpp"
+#include "flat_tree.hpp"
+#include "follow.hpp"
+#include "external.hpp"
+#include "stats.hpp"
 #include "utils.hpp"
 #include "config.h"
 
@@ -46,24 +58,46 @@ struct options {
    char out_field_sep = '\t';
 
    std::string file;
+   std::vector<std::string> files;
    std::string at_coord;
    bool exit = false;
    bool tsv = true;
    bool decorate_tree = true;
+   bool sorted = false;
+   sorted_root root = sorted_root::automatic;
+   bool follow = false;
+   std::size_t memory_limit = 0;
+   int threads = 1;
+   bool stats = false;
+   bool stats_json = false;
+   std::vector<aggregate> aggregates;
+   path_filter filter;
+   bool hash = false;
+   bool input_order = false;
+   bool checksums = false;
 
    auto at() const
    {
      auto const coord = split_line(at_coord, ':');
      auto f = [](auto const& in)
-       { return std::stoi(in); };
+       { return std::stoi(std::string {in}); };
 
      std::vector<int> ret;
      std::transform(std::cbegin(coord), std::cend(coord), std::back_inserter(ret), f);
      return ret;
    }
 
+   // The nodes kept by --match and --exclude, if given.
+   auto select(flat_tree const& t) const
+   {
+      std::vector<char> ret;
+      if (!filter.empty())
+         ret = select_nodes(t, filter);
+      return ret;
+   }
+
    auto
-   make_tree_cfg(std::string const& content,
+   make_tree_cfg(std::string_view content,
                  bool tsv_arg) const
    {
       auto const fmt =
@@ -86,115 +120,163 @@ struct options {
       , in_field_sep
       , out_field_sep
       , out_line_break
-      , decorate_tree};
+      , decorate_tree
+      , threads
+      , aggregates
+      , filter
+      , hash
+      , input_order};
    }
 };
 
 auto
-to_channels(std::string const& data,
+to_channels(std::string_view data,
             oconfig const& cfg,
             int depth)
 {
    tree t {data, cfg};
    auto view = t.level_view({0}, depth);
 
-   auto f = [](auto const& o)
-      { return o.code; };
-
    std::vector<std::vector<int>> channels;
-   std::transform(std::cbegin(view),
-                  std::cend(view),
-                  std::back_inserter(channels),
-                  f);
+   for (auto iter = std::begin(view); iter != std::end(view); ++iter)
+      channels.push_back(iter.code());
 
    return channels;
 }
 
-auto readfile(std::string const& file)
+int op_tsv(options const& op, output_sink& os)
 {
-   using iter_type = std::istreambuf_iterator<char>;
+   input_buffer const in {op.file};
+   auto const str = in.view();
+   auto const cfg = op.make_tree_cfg(str, op.tsv);
+   if (cfg.fmt == oconfig::format::bin)
+      in.advise_random();
 
-   if (std::empty(file))
-      return std::string {iter_type {std::cin}, {}};
+   flat_tree t {str, cfg};
+   auto const selection = op.select(t);
 
-   std::ifstream ifs(file);
-   return std::string {iter_type {ifs}, {}};
-}
+   phase_timer phase {"render"};
+   auto const bytes = os.bytes();
 
-int op_tsv(options const& op)
-{
-   auto const str = readfile(op.file);
-   tree t {str, op.make_tree_cfg(str, op.tsv)};
-
-   auto view = t.level_view(op.at(), op.depth);
-   for (auto iter = std::begin(view); iter != std::end(view); ++iter) {
-      auto const& line = iter.line();
-      auto const ret = join(line, op.out_field_sep);
-      if (!std::empty(ret))
-         std::cout << ret << std::endl;
-   }
+   write_leaf_paths(t, t.at(op.at()), op.depth, op.out_field_sep, os, &selection);
 
+   phase.add(os.bytes() - bytes, t.size());
    return 0;
 }
 
-auto op_info(options const& op)
+auto op_info(options const& op, output_sink& os)
 {
-   auto content = readfile(op.file);
-
-   if (op.tsv) {
-      auto const cfg = op.make_tsv_cfg();
-      content = make_tree_string(content, cfg);
+   input_buffer const in {op.file};
+   auto content = in.view();
+   auto cfg = op.make_tree_cfg(content, op.tsv);
+
+   // Tsv input has to be converted to the tree format first.
+   std::string tree_str;
+   std::vector<node_value> values;
+   if (cfg.fmt == oconfig::format::tsv) {
+      tree_str = make_tree_string(content, op.make_tsv_cfg(), &values);
+      content = tree_str;
+      cfg = op.make_tree_cfg(content, false);
    }
 
-   auto const cfg = op.make_tree_cfg(content, false);
-   tree t {content, cfg};
-   t.load_leaf_counters();
+   if (cfg.fmt == oconfig::format::bin)
+      in.advise_random();
 
-   auto view = t.tsv_view(op.at(), op.depth);
+   flat_tree t {content, cfg};
+   auto const selection = op.select(t);
 
-   auto f =  [&](auto const& node)
-   {
-     std::cout
-        << node.name
+   // The leaves below a node are counted among the nodes kept.
+   std::vector<int> counters;
+   if (std::empty(selection))
+      t.load_leaf_counters(op.threads);
+   else
+      counters = count_selected_leaves(t, selection);
+
+   phase_timer phase {"render"};
+   auto const bytes = os.bytes();
+   for (flat_tsv_traversal iter {t, t.at(op.at()), op.depth, &selection}; !iter.done(); iter.next()) {
+     os << t.name(iter.node())
         << op.out_field_sep
-        << to_string(node.code)
+        << to_string(iter.code())
         << op.out_field_sep
-        << node.leaf_counter
-        << "\n";
-   };
+        << (std::empty(counters) ? t.leaf_counter(iter.node()) : counters[iter.node()]);
+
+     if (!std::empty(values))
+        write_values(os, values[iter.node()], op.aggregates, op.out_field_sep);
 
-   std::for_each(std::cbegin(view), std::cend(view), f);
+     os << '\n';
+   }
 
+   phase.add(os.bytes() - bytes, t.size());
    return 0;
 }
 
-auto op1(options const& op)
+auto op1(options const& op, output_sink& os)
 {
-   auto const content = readfile(op.file);
+   if (op.follow) {
+      follow_tree(op.file, op.make_tsv_cfg(), os);
+      return 0;
+   }
 
-   if (op.tsv) {
+   // Sorted files are merged.
+   if (op.tsv && op.sorted && std::size(op.files) > 1) {
+      write_sorted_files(op.files, op.make_tsv_cfg(), os);
+      return 0;
+   }
+
+   if (op.tsv && op.sorted) {
+      // Decorated output needs the whole tree, falls back to the
+      // in-memory builder below.
       auto const cfg = op.make_tsv_cfg();
-      auto const out = make_tree_string(content, cfg);
-      std::cout << out << std::flush;
+      if (cfg.indentation < 0 || !cfg.decorate) {
+         write_sorted_tree(op.file, cfg, os, op.root);
+         return 0;
+      }
+   }
+
+   // Input larger than the limit is sorted in runs on disk.
+   if (op.tsv && op.memory_limit != 0) {
+      auto const files = std::empty(op.files) ? std::vector<std::string> {""} : op.files;
+      write_tree_external(files, op.make_tsv_cfg(), op.memory_limit, os);
+      return 0;
+   }
+
+   if (std::size(op.files) > 1) {
+      std::string content;
+      for (auto const& f : op.files) {
+         input_buffer const in {f};
+         content += in.view();
+         if (!std::empty(content) && content.back() != '\n')
+            content += '\n';
+      }
+
+      write_tree(content, op.make_tsv_cfg(), os);
       return 0;
    }
 
+   input_buffer const in {op.file};
+   auto const content = in.view();
    auto const cfg = op.make_tree_cfg(content, op.tsv);
-   tree t {content, cfg};
+
+   if (cfg.fmt == oconfig::format::tsv) {
+      write_tree(content, op.make_tsv_cfg(), os);
+      return 0;
+   }
+
+   // Binary trees are not parsed, only the nodes that are output are
+   // read from the file.
+   if (cfg.fmt == oconfig::format::bin)
+      in.advise_random();
+
+   flat_tree t {content, cfg};
    auto const coord = op.at();
-   auto* node = t.at(coord);
+   auto const selection = op.select(t);
 
-   auto const out =
-      serialize(node,
-                op.oc.fmt,
-                op.out_line_break,
-                op.depth,
-                tsvtree::ssize(coord),
-                op.out_field_sep,
-		op.oc.tikz_conf);
+   phase_timer phase {"render"};
+   auto const bytes = os.bytes();
 
    if (op.oc.fmt == oconfig::format::tikz) {
-      std::cout <<
+      os <<
       "\\documentclass[11pt]{article}\n"
       "\\usepackage{graphics}\n"
       "\\usepackage[dvipsnames]{xcolor}\n"
@@ -236,21 +318,79 @@ auto op1(options const& op)
       "\\textnode at (0, 1) {\\huge\\bf\\sc tsvtree};\n";
    }
 
-   std::cout << out << std::flush;
+   serialize(t,
+             t.at(coord),
+             op.oc.fmt,
+             op.out_line_break,
+             op.depth,
+             op.out_field_sep,
+             os,
+             op.oc.tikz_conf,
+             &selection);
 
    if (op.oc.fmt == oconfig::format::tikz) {
-      std::cout <<
+      os <<
       "\\end{tikzpicture}\n"
       "\\endpgfgraphicnamed\n"
       "\\end{document}\n";
    }
 
+   phase.add(os.bytes() - bytes, t.size());
+   return 0;
+}
+
+// Writes the whole tree in binary format together with its leaf
+// counters.
+int op_bin(options const& op, output_sink& os)
+{
+   input_buffer const in {op.file};
+   auto content = in.view();
+   auto cfg = op.make_tree_cfg(content, op.tsv);
+
+   std::string tree_str;
+   if (cfg.fmt == oconfig::format::tsv) {
+      tree_str = make_tree_string(content, op.make_tsv_cfg());
+      content = tree_str;
+      cfg = op.make_tree_cfg(content, false);
+   }
+
+   flat_tree t {content, cfg};
+   t.load_leaf_counters(op.threads);
+
+   phase_timer phase {"render"};
+   write_binary(t, os);
+   phase.add(os.bytes(), t.size());
+
+   return 0;
+}
+
+// Writes the whole tree in compressed binary format.
+int op_comp_bin(options const& op, output_sink& os)
+{
+   input_buffer const in {op.file};
+   auto content = in.view();
+   auto cfg = op.make_tree_cfg(content, op.tsv);
+
+   std::string tree_str;
+   if (cfg.fmt == oconfig::format::tsv) {
+      tree_str = make_tree_string(content, op.make_tsv_cfg());
+      content = tree_str;
+      cfg = op.make_tree_cfg(content, false);
+   }
+
+   flat_tree t {content, cfg};
+
+   phase_timer phase {"render"};
+   write_comp_binary(t, os, op.checksums);
+   phase.add(os.bytes(), t.size());
+
    return 0;
 }
 
-int check_min_depth_op(options const& op)
+int check_min_depth_op(options const& op, output_sink& os)
 {
-   auto const str = readfile(op.file);
+   input_buffer const in {op.file};
+   auto const str = in.view();
    auto const cfg = op.make_tree_cfg(str, op.tsv);
 
    tree t {str, cfg};
@@ -258,24 +398,26 @@ int check_min_depth_op(options const& op)
    auto const out = check_min_depth(view, op.depth);
 
    if (std::empty(out)) {
-      std::cout << "Ok" << std::endl;
+      os << "Ok\n";
       return 0;
    }
 
-   std::cout << "Error on line: " << out << std::endl;
+   os << "Error on line: " << out << '\n';
    return 1;
 }
 
-int impl(options const& op)
+int impl(options const& op, output_sink& os)
 {
    switch (op.oc.fmt) {
-     case oconfig::format::check_min_depth: return check_min_depth_op(op); 
-     case oconfig::format::tree: return op1(op);
-     case oconfig::format::comp: return op1(op);
-     case oconfig::format::info: return op_info(op);
-     case oconfig::format::tsv: return op_tsv(op);
-     case oconfig::format::tree_deco: return op1(op);
-     case oconfig::format::tikz: return op1(op);
+     case oconfig::format::check_min_depth: return check_min_depth_op(op, os); 
+     case oconfig::format::tree: return op1(op, os);
+     case oconfig::format::comp: return op1(op, os);
+     case oconfig::format::info: return op_info(op, os);
+     case oconfig::format::tsv: return op_tsv(op, os);
+     case oconfig::format::tree_deco: return op1(op, os);
+     case oconfig::format::tikz: return op1(op, os);
+     case oconfig::format::bin: return op_bin(op, os);
+     case oconfig::format::comp_bin: return op_comp_bin(op, os);
      default: {
        throw std::runtime_error("Invalid input format.");
        return 1;
@@ -297,13 +439,42 @@ auto make_oformat(std::string const& s, bool deco, bool check_min_depth)
    if (s == "info") return oconfig::format::info;
    if (s == "tsv") return oconfig::format::tsv;
    if (s == "tikz") return oconfig::format::tikz;
+   if (s == "bin") return oconfig::format::bin;
+   if (s == "comp-bin") return oconfig::format::comp_bin;
    return oconfig::format::invalid;
 }
 
+// Sizes in bytes with an optional K, M or G suffix e.g. 512M.
+std::size_t parse_size(std::string const& s)
+{
+   std::size_t n = 0;
+   auto const* end = s.data() + std::size(s);
+   auto const r = std::from_chars(s.data(), end, n);
+   if (r.ec != std::errc {})
+      throw std::runtime_error("Invalid size: " + s);
+
+   std::string_view const suffix {r.ptr, static_cast<std::size_t>(end - r.ptr)};
+   auto shift = 0;
+   if (suffix == "K" || suffix == "k") shift = 10;
+   else if (suffix == "M" || suffix == "m") shift = 20;
+   else if (suffix == "G" || suffix == "g") shift = 30;
+   else if (suffix != "") throw std::runtime_error("Invalid size: " + s);
+
+   if (n > (std::numeric_limits<std::size_t>::max() >> shift))
+      throw std::runtime_error("Invalid size: " + s);
+
+   return n << shift;
+}
+
 auto parse_options(int argc, char* argv[])
 {
    options op;
    std::string of = "tree";
+   std::string memory_limit;
+   std::string root;
+   std::string aggregates;
+   std::vector<std::string> match;
+   std::vector<std::string> exclude;
    po::options_description desc("Options");
    desc.add_options()
    ( "help,h", "This help message.")
@@ -312,12 +483,26 @@ auto parse_options(int argc, char* argv[])
    ( "indent-with-tab,p", "Uses tab to represent the tree depth.")
    ( "at,a", po::value<std::string>(&op.at_coord)->default_value("0"), "Node coordinate.")
    ( "depth,d", po::value<int>(&op.depth)->default_value(std::numeric_limits<int>::max()), "Influences the output.")
-   ( "file,f", po::value<std::string>(&op.file), "The file containing the tree.")
+   ( "file,f", po::value<std::vector<std::string>>(&op.files), "The file containing the tree. Tsv input can be given in more than one file, see --sorted.")
    ( "input-separator,e", po::value<char>(&op.in_field_sep), "Field separator in the input file.")
    ( "input-line-break,r", po::value<char>(&op.in_line_break), "Line break in the input file.")
    ( "output-line-break,b", po::value<char>(&op.out_line_break), "Line break character used in the output.")
    ( "output-separator,s", po::value<char>(&op.out_field_sep), "Output field separator.")
    ( "check-min-depth,c","Checks whether all leaf nodes have at least the depth specified in --depth.")
+   ( "threads", po::value<int>(&op.threads)->default_value(1), "Number of threads used to process tsv input, 0 means one per core.")
+   ( "memory-limit", po::value<std::string>(&memory_limit), "Approximate memory used for the rows of tsv input, e.g. 512M or 2G. Larger input is sorted in runs written to $TMPDIR. Supports the tree and comp output.")
+   ( "follow", "Keeps the tree of the tsv input in memory while rows are appended to it, like tail -f. After the tree of the initial rows, the nodes added by new rows are written with their path. Supports the tree and comp output.")
+   ( "checksums", "Adds a checksum to each block of the comp-bin output, which is verified when it is read.")
+   ( "hash", "Builds the tree of tsv input in a hash table instead of sorting the rows, which is faster on unsorted input. The output is the same.")
+   ( "input-order", "Writes the children of each node in the order they first appear in the tsv input instead of sorted, implies --hash.")
+   ( "match", po::value<std::vector<std::string>>(&match), "Keeps only the nodes whose path matches the pattern, and their ancestors. The levels are separated by / and are globs, ** matches any number of levels e.g. Earth/*/Western Europe/**. Paths begin with Root when it is added. Can be repeated.")
+   ( "exclude", po::value<std::vector<std::string>>(&exclude), "Removes the nodes whose path matches the pattern and their subtrees, see --match. Can be repeated.")
+   ( "value", "The last field of each tsv row is a number that is aggregated over the nodes of the row, see --aggregate. Supports the tree and info output.")
+   ( "aggregate", po::value<std::string>(&aggregates)->default_value("sum"), "Aggregates of the --value column written after each node, a list of sum, min, max and mean e.g. sum,max.")
+   ( "stats", "Writes the time, memory and allocations of each phase and the number of nodes on each depth to stderr.")
+   ( "stats-json", "Like --stats but in JSON.")
+   ( "sorted", "The tsv input is already sorted. Comp and --indent-with-tab output are then written while the input is read, using constant memory. Sorted files are merged instead of sorted again.")
+   ( "root", po::value<std::string>(&root)->default_value("auto"), "Whether the Root node is added above sorted input: auto, always or never. Auto, the default, compares the first and last rows and needs a file.")
    ( "output,o"
    , po::value<std::string>(&of)->default_value("tree")
    , "Format used in the output file. Available options:\n"
@@ -325,7 +510,9 @@ auto parse_options(int argc, char* argv[])
      "• comp: \tCompressed tree.\n"
      "• info: \tInfo of nodes at --depth.\n"
      "• tsv:  \tTSV format.\n"
-     "• tikz:  \tTikZ format."
+     "• tikz:  \tTikZ format.\n"
+     "• bin:  \tBinary format, read without parsing.\n"
+     "• comp-bin: \tCompact binary encoding of comp."
    )
    ( "tikz-x-step,x", po::value<int>(&op.oc.tikz_conf.x_step)->default_value(30), "Node horizontal distance in point units.")
    ( "tikz-y-step,y", po::value<int>(&op.oc.tikz_conf.y_step)->default_value(20), "Node vertical distance in point units.")
@@ -362,10 +549,102 @@ auto parse_options(int argc, char* argv[])
    }
 
    op.tsv = vm.count("tree") == 0;
+   op.sorted = vm.count("sorted") > 0;
+   op.follow = vm.count("follow") > 0;
+
+   if (root == "always") op.root = sorted_root::always;
+   else if (root == "never") op.root = sorted_root::never;
+   else if (root != "auto") {
+      std::cerr << "Invalid --root: " << root << std::endl;
+      op.exit = true;
+      return op;
+   }
+
+   if (!std::empty(memory_limit))
+      op.memory_limit = parse_size(memory_limit);
+
+   auto const tree_output = op.tsv
+                         && (op.oc.fmt == oconfig::format::tree
+                         ||  op.oc.fmt == oconfig::format::tree_deco
+                         ||  op.oc.fmt == oconfig::format::comp);
+
+   if (!std::empty(op.files))
+      op.file = op.files.front();
+
+   if (std::size(op.files) > 1 && (!tree_output || op.follow)) {
+      std::cerr << "More than one file is supported only for tsv input with tree or comp output." << std::endl;
+      op.exit = true;
+      return op;
+   }
+
+   if (op.follow && !tree_output) {
+      std::cerr << "--follow supports only tsv input with tree or comp output." << std::endl;
+      op.exit = true;
+      return op;
+   }
+
+   if (op.memory_limit != 0 && !tree_output) {
+      std::cerr << "--memory-limit supports only tsv input with tree or comp output." << std::endl;
+      op.exit = true;
+      return op;
+   }
+   op.checksums = vm.count("checksums") > 0;
+   if (op.checksums && op.oc.fmt != oconfig::format::comp_bin) {
+      std::cerr << "--checksums is only supported with comp-bin output." << std::endl;
+      op.exit = true;
+      return op;
+   }
+
+   op.input_order = vm.count("input-order") > 0;
+   op.hash = vm.count("hash") > 0 || op.input_order;
+   if (op.hash && (!op.tsv || op.sorted || op.follow || op.memory_limit != 0)) {
+      std::cerr << "--hash and --input-order support only tsv input, without --sorted, --follow or --memory-limit." << std::endl;
+      op.exit = true;
+      return op;
+   }
+
+   if (!std::empty(match) || !std::empty(exclude)) {
+      auto const unsupported = op.sorted
+                            || op.follow
+                            || op.memory_limit != 0
+                            || op.oc.fmt == oconfig::format::check_min_depth
+                            || (op.oc.fmt == oconfig::format::bin && !op.tsv)
+                            || (op.oc.fmt == oconfig::format::comp_bin && !op.tsv);
+
+      if (unsupported) {
+         std::cerr << "--match and --exclude are not supported with --sorted, --follow, --memory-limit, --check-min-depth and binary outputs of tree input." << std::endl;
+         op.exit = true;
+         return op;
+      }
+
+      op.filter = path_filter {match, exclude};
+   }
+
+   if (vm.count("value")) {
+      auto const value_output = op.tsv
+                             && (op.oc.fmt == oconfig::format::tree
+                             ||  op.oc.fmt == oconfig::format::tree_deco
+                             ||  op.oc.fmt == oconfig::format::info);
+
+      if (!value_output || op.sorted || op.follow || op.memory_limit != 0) {
+         std::cerr << "--value supports only tsv input with tree or info output, without --sorted, --follow or --memory-limit." << std::endl;
+         op.exit = true;
+         return op;
+      }
+
+      op.aggregates = parse_aggregates(aggregates);
+   }
+
+   op.stats_json = vm.count("stats-json") > 0;
+   op.stats = vm.count("stats") > 0 || op.stats_json;
+   if (op.threads <= 0)
+      op.threads = std::max(1u, std::thread::hardware_concurrency());
 
    if (op.tsv) {
       if (op.oc.fmt == oconfig::format::comp) op.out_indent = -1;
       if (op.oc.fmt == oconfig::format::info) op.out_indent = -1;
+      if (op.oc.fmt == oconfig::format::bin) op.out_indent = -1;
+      if (op.oc.fmt == oconfig::format::comp_bin) op.out_indent = -1;
    }
 
    return op;
@@ -378,7 +657,22 @@ int main(int argc, char* argv[])
       if (op.exit)
          return 0;
 
-      return impl(op);
+      if (op.stats)
+         stats.enable();
+
+      // The output is written only at the end or when the buffer of
+      // the sink is full.
+      fd_sink os {STDOUT_FILENO};
+      auto const ret = impl(op, os);
+
+      phase_timer flush_phase {"flush"};
+      os.flush();
+      flush_phase.stop();
+
+      if (stats.enabled())
+         stats.report(std::cerr, op.stats_json);
+
+      return ret;
    } catch (std::exception const& e) {
       std::cerr << e.what() << std::endl;
       return 1;
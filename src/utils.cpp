@@ -17,9 +17,9 @@
  */
 
 #include "utils.hpp"
+#include "scan.hpp"
 
 #include <vector>
-#include <sstream>
 #include <cassert>
 #include <algorithm>
 
@@ -113,7 +113,7 @@ to_channel_codes(std::vector<std::vector<int>> const& o,
    return ret;
 }
 
-std::string to_string(std::vector<int> const& v, char delimiter)
+std::string to_string(array_view<int const> v, char delimiter)
 {
    if (std::empty(v))
       return {};
@@ -129,45 +129,65 @@ std::string to_string(std::vector<int> const& v, char delimiter)
    return code;
 }
 
-char const* make_indent_block(int i, int depth, bool last)
+std::string_view deco_prefix::next(int depth, bool last)
 {
-   static char const* blocks[] =
-   { ""     // 0
-   , "    " // 1
-   , "│   " // 2
-   , "└── " // 3
-   , "├── " // 4
-   , "Please, report error for entry: "
-   };
-
-   if (depth == 0)             return blocks[0];
-   if (i < depth - 1 && last)  return blocks[1];
-   if (i < depth - 1)          return blocks[2];
-   if (i == depth - 1 && last) return blocks[3];
-   if (i == depth - 1)         return blocks[4];
-
-   assert(false);
-   return blocks[5];
+   if (depth == 0) {
+      str_.clear();
+      lasts_.clear();
+      offsets_.assign(1, 0);
+      return {};
+   }
+
+   auto const parent = depth - 1;
+   auto const prev = tsvtree::ssize(lasts_);
+   assert(depth <= prev + 1);
+
+   if (depth == prev + 1) {
+      // A child of the previous node, whose block now continues the
+      // line of its siblings, if any.
+      if (prev > 0) {
+         str_.resize(offsets_[prev - 1]);
+         str_ += lasts_[prev - 1] ? "    " : "│   ";
+         offsets_[prev] = std::size(str_);
+      }
+   } else {
+      // The blocks of the ancestors are kept.
+      str_.resize(offsets_[parent]);
+      lasts_.resize(parent);
+      offsets_.resize(depth);
+   }
+
+   str_ += last ? "└── " : "├── ";
+   lasts_.push_back(last);
+   offsets_.push_back(std::size(str_));
+   return str_;
 }
 
-std::string make_deco_indent(int depth, std::vector<bool> const& lasts)
+std::vector<std::string_view> split_line(std::string_view in, char sep)
 {
-  std::string ret;
-  for (auto i = 0; i < depth; ++i)
-     ret += make_indent_block(i, depth, lasts[i]);
-  return ret;
+   std::vector<std::string_view> ret;
+   split_line(in, sep, ret);
+   return ret;
 }
 
-std::vector<std::string> split_line(std::string const& in, char sep)
+void
+split_line(std::string_view in,
+           char sep,
+           std::vector<std::string_view>& fields)
 {
-   std::string line;
-   std::istringstream iss(in);
-   std::vector<std::string> ret;
-   while (std::getline(iss, line, sep))
-      if (!std::empty(line))
-         ret.push_back(line);
-
-   return ret;
+   fields.clear();
+   delim_scanner scanner {in, sep, sep};
+   std::size_t begin = 0;
+   for (;;) {
+      auto const p = scanner.next();
+      if (p != begin)
+         fields.push_back(in.substr(begin, p - begin));
+
+      if (p == std::size(in))
+         break;
+
+      begin = p + 1;
+   }
 }
 
 } // tsvtree
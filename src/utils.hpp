@@ -19,8 +19,12 @@
 #pragma once
 
 #include <vector>
+#include <string>
 #include <cstdint>
+#include <charconv>
 #include <iterator>
+#include <stdexcept>
+#include <string_view>
 
 namespace tsvtree
 {
@@ -29,6 +33,45 @@ template <class C>
 auto ssize(C const& c)
    { return static_cast<int>(std::size(c)); }
 
+// Non-owning view of a contiguous array, for example one allocated in
+// an arena.
+template <class T>
+class array_view {
+private:
+   T* data_ = nullptr;
+   int size_ = 0;
+
+public:
+   array_view() = default;
+   array_view(T* data, int size) : data_ {data}, size_ {size} { }
+
+   template <class C>
+   array_view(C& c) : data_ {std::data(c)}, size_ {tsvtree::ssize(c)} { }
+
+   auto data() const noexcept { return data_; }
+   auto size() const noexcept { return size_; }
+   auto empty() const noexcept { return size_ == 0; }
+   auto begin() const noexcept { return data_; }
+   auto end() const noexcept { return data_ + size_; }
+   auto& front() const noexcept { return data_[0]; }
+   auto& back() const noexcept { return data_[size_ - 1]; }
+   auto& operator[](int i) const noexcept { return data_[i]; }
+};
+
+// Parses the value of a command line argument, which must be a number
+// of type T and nothing else. The error names the argument.
+template <class T>
+T parse_number(std::string_view name, std::string_view s)
+{
+   T ret {};
+   auto const* end = s.data() + std::size(s);
+   auto const r = std::from_chars(s.data(), end, ret);
+   if (std::empty(s) || r.ec != std::errc {} || r.ptr != end)
+      throw std::runtime_error("Invalid " + std::string {name} + ": " + std::string {s});
+
+   return ret;
+}
+
 using code_type = std::uint64_t;
 code_type make_code(std::vector<int> const& c, int depth);
 
@@ -37,11 +80,34 @@ to_channel_codes(std::vector<std::vector<int>> const& o,
                  int depth,
                  int max);
 
-std::string to_string(std::vector<int> const& v, char delimiter = ':');
+std::string to_string(array_view<int const> v, char delimiter = ':');
+
+// The indentation of the decorated tree output e.g. "│   ├── ". It
+// is updated from node to node in pre-order, where only the blocks
+// after the ancestors of the new node change, instead of being built
+// again for every node.
+class deco_prefix {
+private:
+   std::string str_;
+   std::vector<bool> lasts_;
+   std::vector<std::size_t> offsets_ {0};
+
+public:
+   // Returns the indentation of the next node, that is at the given
+   // depth and is or not the last child of its parent. The view is
+   // valid until the next call.
+   std::string_view next(int depth, bool last);
+};
 
-std::string make_deco_indent(int depth, std::vector<bool> const& lasts);
+// Splits the line in its fields, empty fields are skipped. The
+// returned views point into in.
+std::vector<std::string_view> split_line(std::string_view in, char sep);
 
-std::vector<std::string> split_line(std::string const& in, char sep);
+// Like above but reuses the memory of fields, for rows read one by one.
+void
+split_line(std::string_view in,
+           char sep,
+           std::vector<std::string_view>& fields);
 
 }
 